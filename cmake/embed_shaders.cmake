@@ -0,0 +1,30 @@
+# Write every .glsl file in SHADER_DIR into OUTPUT as a table of C++ raw
+# string literals, so the executable needs no shader files at run time.
+# Run in script mode: cmake -DSHADER_DIR=... -DOUTPUT=... -P embed_shaders.cmake
+
+file(GLOB shaders RELATIVE "${SHADER_DIR}" "${SHADER_DIR}/*.glsl")
+list(SORT shaders)
+
+set(content "// Generated from shaders/ by cmake/embed_shaders.cmake, do not edit\n")
+string(APPEND content "#include \"embedded_shaders.h\"\n\n")
+string(APPEND content "const EmbeddedShader EMBEDDED_SHADERS[] = {\n")
+foreach(shader ${shaders})
+    file(READ "${SHADER_DIR}/${shader}" source)
+    string(FIND "${source}" ")glsl\"" clash)
+    if(NOT clash EQUAL -1)
+        message(FATAL_ERROR "${shader} contains the raw string delimiter )glsl\"")
+    endif()
+    string(APPEND content "    {\"${shader}\", R\"glsl(${source})glsl\"},\n")
+endforeach()
+string(APPEND content "};\n\n")
+list(LENGTH shaders count)
+string(APPEND content "const int EMBEDDED_SHADER_COUNT = ${count};\n")
+
+# Leave the file alone when nothing changed, so it is not recompiled
+set(previous "")
+if(EXISTS "${OUTPUT}")
+    file(READ "${OUTPUT}" previous)
+endif()
+if(NOT previous STREQUAL content)
+    file(WRITE "${OUTPUT}" "${content}")
+endif()
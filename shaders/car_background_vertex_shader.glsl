@@ -0,0 +1,76 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+
+uniform float laneOriginX;
+uniform float laneSpacing;
+uniform float roadLength;
+uniform int carsPerStreet;
+uniform float trafficTime;     // Simulation ticks since startup
+uniform int cameraStreet;      // Street index nearest to the camera
+uniform int streetRadius;      // Streets drawn either side of cameraStreet
+uniform float cameraX;
+uniform float nearRadius;      // Streets closer than this are simulated on the CPU
+uniform bool wheels;
+
+out vec3 FragPos;
+out vec3 ModelPos;  // Position on the mesh, for the lights at its ends
+out vec3 Normal;
+out vec3 CarColor;
+flat out int BrakingLights;
+out float HeadlightIntensity;
+
+// Must match trafficHash() in traffic.cpp
+uint trafficHash(uint v)
+{
+    uint h = v * 747796405u + 2891336453u;
+    h = ((h >> ((h >> 28u) + 4u)) ^ h) * 277803737u;
+    return (h >> 22u) ^ h;
+}
+
+int wrapIndex(int a, int n)
+{
+    return a - n * int(floor(float(a) / float(n)));
+}
+
+void main() {
+    int street = cameraStreet - streetRadius + gl_InstanceID / carsPerStreet;
+    int slot = gl_InstanceID % carsPerStreet;
+    float streetX = laneOriginX + float(street) * laneSpacing;
+
+    // Near streets are drawn by renderCars(), so collapse those instances outside the clip volume
+    if (abs(streetX - cameraX) < nearRadius) {
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+
+    // Closed-form position along the street, see backgroundCarZ() in traffic.cpp
+    uint h = trafficHash(uint(street + 0x100000));
+    float speed = 0.02 + float(h & 0xffffu) / 65535.0 * 0.02;
+    float phase = float((h >> 16u) & 0xffffu) / 65535.0 * (roadLength / float(carsPerStreet));
+    float travel = mod(float(slot) * (roadLength / float(carsPerStreet)) + phase + speed * trafficTime, roadLength);
+    bool forward = wrapIndex(street, 2) == 0;
+    float z = forward ? travel - roadLength / 2.0 : roadLength / 2.0 - travel;
+
+    // Rotate cars heading towards -z by 180 degrees, as renderCars() does
+    vec3 localPos = forward ? aPos : vec3(-aPos.x, aPos.y, -aPos.z);
+    FragPos = localPos + vec3(streetX, 0.3, z);
+    ModelPos = aPos;
+    Normal = forward ? aNormal : vec3(-aNormal.x, aNormal.y, -aNormal.z);
+
+    // Alternate colors for visual variety, matching initializeCars()
+    int colorIndex = wrapIndex(street, 3);
+    if (wheels) {
+        CarColor = vec3(0.1, 0.1, 0.1);
+    } else if (colorIndex == 0) {
+        CarColor = vec3(0.8, 0.2, 0.2); // Red
+    } else if (colorIndex == 1) {
+        CarColor = vec3(0.2, 0.2, 0.8); // Blue
+    } else {
+        CarColor = vec3(0.8, 0.8, 0.8); // Silver
+    }
+    BrakingLights = 0;
+    HeadlightIntensity = 1.0;
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -0,0 +1,47 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 4) in vec4 aState; // z, speed, lane, flags
+
+uniform float laneOriginX;
+uniform float laneSpacing;
+uniform bool wheels;
+
+out vec3 FragPos;
+out vec3 ModelPos;  // Position on the mesh, for the lights at its ends
+out vec3 Normal;
+out vec3 CarColor;
+flat out int BrakingLights;
+out float HeadlightIntensity;
+
+int wrapIndex(int a, int n)
+{
+    return a - n * int(floor(float(a) / float(n)));
+}
+
+void main() {
+    int lane = int(aState.z);
+    int flags = int(aState.w);
+
+    // Rotate cars heading towards -z by 180 degrees, as renderCars() does
+    vec3 localPos = (flags & 1) != 0 ? aPos : vec3(-aPos.x, aPos.y, -aPos.z);
+    FragPos = localPos + vec3(laneOriginX + float(lane) * laneSpacing, 0.3, aState.x);
+    ModelPos = aPos;
+    Normal = (flags & 1) != 0 ? aNormal : vec3(-aNormal.x, aNormal.y, -aNormal.z);
+
+    // Alternate colors for visual variety, matching initializeCars()
+    int colorIndex = wrapIndex(lane, 3);
+    if (wheels) {
+        CarColor = vec3(0.1, 0.1, 0.1);
+    } else if (colorIndex == 0) {
+        CarColor = vec3(0.8, 0.2, 0.2); // Red
+    } else if (colorIndex == 1) {
+        CarColor = vec3(0.2, 0.2, 0.8); // Blue
+    } else {
+        CarColor = vec3(0.8, 0.8, 0.8); // Silver
+    }
+    BrakingLights = (flags & 2) != 0 ? 1 : 0;
+    HeadlightIntensity = 1.0;
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -0,0 +1,13 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec3 SpriteColor;
+
+void main() {
+    // Round sprites
+    vec2 d = gl_PointCoord - vec2(0.5);
+    if (dot(d, d) > 0.25) {
+        discard;
+    }
+    FragColor = vec4(SpriteColor, 1.0);
+}
@@ -0,0 +1,24 @@
+#version 330 core
+layout (location = 4) in vec4 aPlacement;   // position, yaw in radians
+layout (location = 5) in vec4 aAppearance;  // color, flags: 1 moving forward, 2 braking
+layout (location = 6) in float aPixels;     // Projected length of the car
+
+out vec3 SpriteColor;
+
+void main() {
+    // A car a few pixels long is mostly its lights: headlights when its front
+    // faces the camera, tail lights (bright when braking) when its back does
+    vec3 front = vec3(-sin(aPlacement.w), 0.0, -cos(aPlacement.w));
+    float facing = dot(front, normalize(cameraPos - aPlacement.xyz));
+    bool braking = (int(aAppearance.a) & 2) != 0;
+    vec3 tailLight = braking ? vec3(1.0, 0.0, 0.0) : vec3(0.5, 0.05, 0.05);
+    SpriteColor = aAppearance.rgb * 0.5;
+    SpriteColor = mix(SpriteColor, vec3(1.0, 1.0, 0.8), clamp(facing * 2.0, 0.0, 1.0));
+    SpriteColor = mix(SpriteColor, tailLight, clamp(-facing * 2.0, 0.0, 1.0));
+#ifdef FOG
+    SpriteColor = applyFog(SpriteColor, aPlacement.xyz);
+#endif
+
+    gl_Position = projection * view * vec4(aPlacement.xyz, 1.0);
+    gl_PointSize = clamp(aPixels, 1.0, 8.0);
+}
@@ -1,15 +1,47 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
 
+#ifdef INSTANCING
+layout (location = 4) in vec4 aPlacement;   // position, yaw in radians
+layout (location = 5) in vec4 aAppearance;  // color, flags: 1 moving forward, 2 braking
+
+uniform bool wheels;
+#else
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform vec3 carColor;
+uniform bool brakingLights;
+uniform float headlightIntensity;
+#endif
 
 out vec3 FragPos;
+out vec3 ModelPos;  // Position on the mesh, for the lights at its ends
 out vec3 Normal;
+out vec3 CarColor;
+flat out int BrakingLights;
+out float HeadlightIntensity;
 
 void main() {
+#ifdef INSTANCING
+    // Rotate about +y as renderCars() used to with glm::rotate()
+    float c = cos(aPlacement.w);
+    float s = sin(aPlacement.w);
+    vec3 localPos = vec3(c * aPos.x + s * aPos.z, aPos.y, -s * aPos.x + c * aPos.z);
+
+    FragPos = localPos + aPlacement.xyz;
+    Normal = vec3(c * aNormal.x + s * aNormal.z, aNormal.y, -s * aNormal.x + c * aNormal.z);
+    CarColor = wheels ? vec3(0.1, 0.1, 0.1) : aAppearance.rgb;
+    BrakingLights = (int(aAppearance.a) & 2) != 0 ? 1 : 0;
+    HeadlightIntensity = 1.0;
+#else
     FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * normalize(aPos);
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    // The model matrix only rotates, translates and scales uniformly, so its
+    // upper 3x3 keeps normals perpendicular; the fragment shader normalizes them
+    Normal = mat3(model) * aNormal;
+    CarColor = carColor;
+    BrakingLights = brakingLights ? 1 : 0;
+    HeadlightIntensity = headlightIntensity;
+#endif
+    ModelPos = aPos;
+    gl_Position = projection * view * vec4(FragPos, 1.0);
 }
@@ -0,0 +1,7 @@
+#version 330 core
+out vec4 FragColor;
+
+// Flat grey for geometry whose own program is still compiling
+void main() {
+    FragColor = vec4(0.35, 0.35, 0.4, 1.0);
+}
@@ -0,0 +1,30 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;       // X-wing mesh from setupXWing()
+layout (location = 1) in vec3 aNormal;
+layout (location = 4) in vec4 aInstance;  // position, heading in radians
+
+out vec3 FragPos;
+out vec3 ModelPos;  // Position on the mesh, for the lights at its ends
+out vec3 Normal;
+out vec3 CarColor;
+flat out int BrakingLights;
+out float HeadlightIntensity;
+
+void main() {
+    // Turn the nose (-z) to the heading, as glm::rotate() about +y would, and scale as renderXWing() does
+    float c = cos(aInstance.w);
+    float s = sin(aInstance.w);
+    vec3 p = aPos * 0.7;
+    vec3 localPos = vec3(c * p.x + s * p.z, p.y, -s * p.x + c * p.z);
+
+    FragPos = localPos + aInstance.xyz;
+    ModelPos = aPos;
+    Normal = vec3(c * aNormal.x + s * aNormal.z, aNormal.y, -s * aNormal.x + c * aNormal.z);
+
+    // Dark metallic like the player's ship
+    CarColor = vec3(0.3, 0.3, 0.35);
+    BrakingLights = 0;
+    HeadlightIntensity = 0.0;
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
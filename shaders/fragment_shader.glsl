@@ -6,9 +6,6 @@ in vec2 TexCoords;
 in vec3 Normal;
 
 uniform sampler2D texture1;
-uniform vec3 lightPos;
-uniform vec3 viewPos;
-uniform vec3 lightColor;
 uniform float fadeValue;  // Add this line
 
 void main() {
@@ -18,18 +15,31 @@ void main() {
 
     // Diffuse lighting
     vec3 norm = normalize(Normal);
-    vec3 lightDir = normalize(lightPos - FragPos);
+    vec3 lightDir = lightDirection(FragPos);
     float diff = max(dot(norm, lightDir), 0.0);
     vec3 diffuse = diff * lightColor;
 
     // Specular lighting
     float specularStrength = 0.5;
-    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 viewDir = normalize(cameraPos - FragPos);
     vec3 reflectDir = reflect(-lightDir, norm);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
     vec3 specular = specularStrength * spec * lightColor;
 
+#ifdef SUN_SHADOWS
+    float sun = sunVisibility(FragPos, norm);
+    diffuse *= sun;
+    specular *= sun;
+#endif
+
+#ifdef CAR_LIGHTS
+    diffuse += carLights(FragPos, norm);
+#endif
+
     // Combine lighting with fade value
     vec3 result = (ambient + diffuse + specular) * texture(texture1, TexCoords).rgb;
+#ifdef FOG
+    result = applyFog(result, FragPos);
+#endif
     FragColor = vec4(result, fadeValue);  // Use fade value for alpha
 }
\ No newline at end of file
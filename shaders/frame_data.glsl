@@ -0,0 +1,161 @@
+// Camera and light data for the frame, shared by every program and updated
+// once per frame by updateFrameData(). compileShader() inserts this block
+// after the #version line of every shader it compiles, behind the #defines of
+// the program's features. Layout mirrors the FrameData struct in main.cpp.
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    mat4 skyInverseViewProjection;  // Clip space to directions from the camera
+    vec3 cameraPos;
+    vec3 lightPos;
+    vec3 lightColor;
+    mat4 shadowMatrices[3];  // World to the clip space of each shadow cascade
+    vec4 shadowSplits;       // View distance each cascade covers to
+    vec4 shadowTexelSizes;   // World units per texel of each cascade
+    vec4 heightFieldLayout;  // x and z of the corner of cell (0, 0), cell size, tallest building
+    vec4 clusterGrid;        // Light clusters across, down and deep
+    vec4 clusterSlicing;     // Scale and bias from log view depth to a cluster slice
+};
+
+// Either technique casts sun shadows through sunVisibility()
+#if defined(SHADOWS) || defined(HEIGHTFIELD_SHADOWS)
+#define SUN_SHADOWS
+#endif
+
+// Direction towards the light from a point
+vec3 lightDirection(vec3 position) {
+#ifdef SUN_SHADOWS
+    // The shadows are cast by a sun, as far as lightPos seen from the origin,
+    // so the shading follows the same parallel light
+    return normalize(lightPos);
+#else
+    return normalize(lightPos - position);
+#endif
+}
+
+#ifdef FOG
+// Fade a colour towards the night sky with its distance from the camera
+const vec3 FOG_COLOR = vec3(0.1, 0.07, 0.2);
+const float FOG_DENSITY = 0.04;
+
+vec3 applyFog(vec3 color, vec3 position) {
+    float d = length(cameraPos - position) * FOG_DENSITY;
+    return mix(FOG_COLOR, color, exp(-d * d));
+}
+#endif
+
+#if defined(HEIGHTFIELD_SHADOWS)
+// Building heights, one texel per building: the city is a grid of cells, each
+// a building footprint in the middle of a square of street, and the columns
+// and rows of buildings wrap round it. Texel (row, column), as buildingHeights
+// is laid out in main.cpp.
+uniform sampler2D heightField;
+
+const int HEIGHT_FIELD_STEPS = 32;
+const float FOOTPRINT_LOW = 0.25;  // The building's share of its cell, in cells
+const float FOOTPRINT_HIGH = 0.75;
+
+// March towards the sun through the cells the ray crosses (a 2D DDA), testing
+// it against the building in each, until it rises above the tallest building.
+// The answer is exact, 0 or 1, and the loop is bounded.
+float sunVisibility(vec3 position, vec3 normal) {
+    vec3 dir = lightDirection(position);
+    // Off the surface, so walls facing the sun do not shadow themselves
+    vec3 start = position + normalize(normal) * 0.01;
+    vec2 p = (start.xz - heightFieldLayout.xy) / heightFieldLayout.z;
+    vec2 d = dir.xz / heightFieldLayout.z;
+    d = mix(d, vec2(1e-6), lessThan(abs(d), vec2(1e-6)));
+    vec2 invD = 1.0 / d;
+
+    ivec2 cell = ivec2(floor(p));
+    ivec2 cellStep = ivec2(sign(d));
+    vec2 tNext = (vec2(cell) + max(sign(d), 0.0) - p) * invD;  // Along the ray to the next column and row
+    vec2 tDelta = abs(invD);
+    vec2 size = vec2(textureSize(heightField, 0));
+
+    for (int i = 0; i < HEIGHT_FIELD_STEPS; i++) {
+        vec2 t0 = (vec2(cell) + FOOTPRINT_LOW - p) * invD;
+        vec2 t1 = (vec2(cell) + FOOTPRINT_HIGH - p) * invD;
+        float tEnter = max(max(min(t0.x, t1.x), min(t0.y, t1.y)), 0.0);
+        float tExit = min(max(t0.x, t1.x), max(t0.y, t1.y));
+        if (tEnter <= tExit) {
+            // The ray rises, so it is lowest where it enters the footprint
+            float height = texelFetch(heightField, ivec2(mod(vec2(cell.yx), size.xy)), 0).r;
+            if (start.y + dir.y * tEnter < height) {
+                return 0.0;
+            }
+        }
+        float tCell = min(tNext.x, tNext.y);
+        if (start.y + dir.y * tCell > heightFieldLayout.w) {
+            break;
+        }
+        if (tNext.x < tNext.y) {
+            tNext.x += tDelta.x;
+            cell.x += cellStep.x;
+        } else {
+            tNext.y += tDelta.y;
+            cell.y += cellStep.y;
+        }
+    }
+    return 1.0;
+}
+#elif defined(SHADOWS)
+uniform sampler2DArrayShadow shadowMap;
+
+// How much of the sun reaches a surface point, from 0 in shadow to 1
+float sunVisibility(vec3 position, vec3 normal) {
+    float viewDistance = length(position - cameraPos);
+    if (viewDistance >= shadowSplits.z) {
+        return 1.0;
+    }
+    int cascade = viewDistance < shadowSplits.x ? 0 : (viewDistance < shadowSplits.y ? 1 : 2);
+    // Looked up a little off the surface, against acne
+    vec3 offset = normalize(normal) * shadowTexelSizes[cascade] * 1.5;
+    vec3 coords = (shadowMatrices[cascade] * vec4(position + offset, 1.0)).xyz * 0.5 + 0.5;
+    return texture(shadowMap, vec4(coords.xy, float(cascade), coords.z));
+}
+#endif
+
+#ifdef CAR_LIGHTS
+// The car headlights and brake lights of light_clusters.h: the lights, the
+// first index and count of each cluster's lights, and the lists themselves
+uniform samplerBuffer lightData;
+uniform isamplerBuffer lightClusters;
+uniform isamplerBuffer lightIndices;
+
+// Diffuse light from the lights listed in the cluster a point falls in. The
+// cluster is found from the position rather than gl_FragCoord, as this block
+// is compiled into every stage.
+vec3 carLights(vec3 position, vec3 normal) {
+    vec4 viewPos = view * vec4(position, 1.0);
+    vec4 clip = projection * viewPos;
+    vec2 tile = clamp(floor((clip.xy / clip.w * 0.5 + 0.5) * clusterGrid.xy), vec2(0.0), clusterGrid.xy - 1.0);
+    float slice = clamp(floor(log(max(-viewPos.z, 1e-4)) * clusterSlicing.x + clusterSlicing.y), 0.0,
+                        clusterGrid.z - 1.0);
+    int cluster = int(tile.x) + int(clusterGrid.x) * (int(tile.y) + int(clusterGrid.y) * int(slice));
+    ivec2 range = texelFetch(lightClusters, cluster).xy;
+
+    vec3 n = normalize(normal);
+    vec3 total = vec3(0.0);
+    for (int i = 0; i < range.y; i++) {
+        int light = texelFetch(lightIndices, range.x + i).r * 3;
+        vec4 positionRadius = texelFetch(lightData, light);
+        vec4 colorCone = texelFetch(lightData, light + 1);
+        vec3 toLight = positionRadius.xyz - position;
+        float d = length(toLight);
+        if (d >= positionRadius.w) {
+            continue;
+        }
+        vec3 l = toLight / d;
+        float falloff = 1.0 - d / positionRadius.w;
+        float cone = 1.0;
+        if (colorCone.w > -1.0) {
+            // Soft over the outer quarter of the cone
+            float facing = dot(-l, texelFetch(lightData, light + 2).xyz);
+            cone = smoothstep(colorCone.w, mix(colorCone.w, 1.0, 0.25), facing);
+        }
+        total += colorCone.rgb * max(dot(n, l), 0.0) * falloff * falloff * cone;
+    }
+    return total;
+}
+#endif
@@ -0,0 +1,32 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;       // Figure from setupPedestrians()
+layout (location = 1) in vec3 aNormal;
+layout (location = 4) in vec4 aInstance;  // x, z, heading in radians, walking speed
+
+out vec3 FragPos;
+out vec3 ModelPos;  // Position on the mesh, for the lights at its ends
+out vec3 Normal;
+out vec3 CarColor;
+flat out int BrakingLights;
+out float HeadlightIntensity;
+
+void main() {
+    // Turn the front (-z) to the heading, as glm::rotate() about +y would
+    float c = cos(aInstance.z);
+    float s = sin(aInstance.z);
+    vec3 localPos = vec3(c * aPos.x + s * aPos.z, aPos.y, -s * aPos.x + c * aPos.z);
+
+    // Bob up and down with each step
+    float bob = abs(sin(aInstance.y * 40.0)) * 0.01;
+    FragPos = localPos + vec3(aInstance.x, bob, aInstance.y);
+    ModelPos = aPos;
+    Normal = vec3(c * aNormal.x + s * aNormal.z, aNormal.y, -s * aNormal.x + c * aNormal.z);
+
+    // Every walking speed is different, so it picks the clothes
+    float h = fract(sin(aInstance.w * 12345.678) * 43758.5453);
+    CarColor = mix(vec3(0.15, 0.2, 0.35), vec3(0.7, 0.45, 0.3), h);
+    BrakingLights = 0;
+    HeadlightIntensity = 0.0;
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
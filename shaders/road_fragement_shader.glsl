@@ -3,9 +3,18 @@
 out vec4 FragColor;
 
 in vec2 TexCoords;
+in vec3 FragPos;
 
 uniform sampler2D roadTexture;
 
+// Unlit, as the road of the uber shader
 void main() {
     FragColor = texture(roadTexture, TexCoords);
+#ifdef SUN_SHADOWS
+    // Darkened where a shadow falls
+    FragColor.rgb *= mix(0.5, 1.0, sunVisibility(FragPos, vec3(0.0, 1.0, 0.0)));
+#endif
+#ifdef CAR_LIGHTS
+    FragColor.rgb += carLights(FragPos, vec3(0.0, 1.0, 0.0)) * FragColor.rgb;
+#endif
 }
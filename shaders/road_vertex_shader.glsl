@@ -4,12 +4,12 @@ layout(location = 0) in vec3 aPos;  // Position
 layout(location = 1) in vec2 aTexCoords;  // Texture Coordinates
 
 out vec2 TexCoords;
+out vec3 FragPos;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 void main() {
     TexCoords = aTexCoords;
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    FragPos = vec3(model * vec4(aPos, 1.0));
+    gl_Position = projection * view * vec4(FragPos, 1.0);
 }
@@ -0,0 +1,11 @@
+#version 330 core
+// Buildings into a shadow cascade, with the attributes of vertex_shader.glsl
+layout (location = 0) in vec3 aPos;
+layout (location = 3) in vec3 aOffset;
+layout (location = 4) in vec3 aScale;
+
+uniform mat4 lightViewProjection;
+
+void main() {
+    gl_Position = lightViewProjection * vec4(aPos * aScale + aOffset, 1.0);
+}
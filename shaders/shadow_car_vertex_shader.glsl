@@ -0,0 +1,13 @@
+#version 330 core
+// Cars into a shadow cascade, with the attributes of the instanced car_vertex_shader.glsl
+layout (location = 0) in vec3 aPos;
+layout (location = 4) in vec4 aPlacement;  // position, yaw in radians
+
+uniform mat4 lightViewProjection;
+
+void main() {
+    float c = cos(aPlacement.w);
+    float s = sin(aPlacement.w);
+    vec3 localPos = vec3(c * aPos.x + s * aPos.z, aPos.y, -s * aPos.x + c * aPos.z);
+    gl_Position = lightViewProjection * vec4(localPos + aPlacement.xyz, 1.0);
+}
@@ -0,0 +1,5 @@
+#version 330 core
+
+// Shadow maps only need the depth
+void main() {
+}
@@ -0,0 +1,9 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec3 LampColor;
+
+void main() {
+    // Lamps glow, so they skip the lighting
+    FragColor = vec4(LampColor, 1.0);
+}
@@ -0,0 +1,28 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;    // Lamp boxes; x > 0 shows the street light, x < 0 the cross street light
+layout (location = 4) in vec4 aSignal; // x, z, phase, unused
+
+out vec3 LampColor;
+
+void main() {
+    // Phases as in traffic_signals.h
+    int phase = int(aSignal.z + 0.5);
+    if (phase == 0) {
+        // Unlit intersection: drop the lamps outside the clip volume
+        LampColor = vec3(0.0);
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+
+    bool streetLamp = aPos.x > 0.0;
+    int green = streetLamp ? 1 : 3;
+    if (phase == green) {
+        LampColor = vec3(0.1, 1.0, 0.2);   // Green
+    } else if (phase == green + 1) {
+        LampColor = vec3(1.0, 0.6, 0.0);   // Amber while the intersection clears
+    } else {
+        LampColor = vec3(1.0, 0.1, 0.1);   // Red
+    }
+
+    gl_Position = projection * view * vec4(aPos + vec3(aSignal.x, 0.0, aSignal.y), 1.0);
+}
@@ -1,12 +1,21 @@
 #version 330 core
 out vec4 FragColor;
 
-in vec2 TexCoords;
+in vec3 ViewRay;
 
 uniform sampler2D skyboxTexture;
 
+const float PI = 3.14159265;
+const float SKY_HORIZON = 0.67;  // Height of the horizon in sky.jpg, from the top
+
 void main()
-{    
-    vec4 texColor = texture(skyboxTexture, TexCoords);
-    FragColor = texColor;
-}
\ No newline at end of file
+{
+    // Equirectangular: the image wraps once around the camera and spans half
+    // a turn from top to bottom, shifted so its horizon meets the real one
+    vec3 direction = normalize(ViewRay);
+    float u = 0.5 + atan(direction.x, -direction.z) / (2.0 * PI);
+    float v = clamp(SKY_HORIZON - asin(direction.y) / PI, 0.0, 1.0);
+
+    // The wrap of u jumps at the back, where derivatives would pick the smallest mipmap
+    FragColor = textureLod(skyboxTexture, vec2(u, v), 0.0);
+}
@@ -1,17 +1,17 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
+// A triangle covering the screen, from gl_VertexID alone
 
-out vec2 TexCoords;
-
-uniform mat4 projection;
-uniform mat4 view;
+out vec3 ViewRay;
 
 void main()
 {
-    // Convert to clip space while preserving w-component for depth testing
-    vec4 pos = projection * view * vec4(aPos, 1.0);
-    gl_Position = pos.xyww; // Force depth to be maximum
-    
-    // Calculate texture coordinates from vertex position
-    TexCoords = vec2(aPos.x + 0.5, aPos.y + 0.5);
-}
\ No newline at end of file
+    vec2 position = vec2(gl_VertexID == 1 ? 3.0 : -1.0, gl_VertexID == 2 ? 3.0 : -1.0);
+
+    // At the far plane, so only pixels nothing was drawn on pass the depth test
+    gl_Position = vec4(position, 1.0, 1.0);
+
+    // Points on the far plane are affine in the screen position, so the
+    // direction through each pixel interpolates linearly
+    vec4 farPoint = skyInverseViewProjection * vec4(position, 1.0, 1.0);
+    ViewRay = farPoint.xyz / farPoint.w;
+}
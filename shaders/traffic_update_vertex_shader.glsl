@@ -0,0 +1,56 @@
+#version 330 core
+layout (location = 0) in vec4 aState; // z, speed, lane, flags
+
+// Same buffer as aState, used to look up the car ahead in the lane
+uniform samplerBuffer trafficState;
+uniform int carsPerLane;
+uniform float roadLength;
+
+out vec4 outState;
+
+const float BRAKING_DISTANCE = 2.0;
+const float MIN_GAP = 1.2; // One car length, so cars never overtake their leader
+
+// Per-car cruising speed in the same 0.02 - 0.04 range as the CPU cars
+float cruiseSpeed(int id)
+{
+    uint h = uint(id) * 747796405u + 2891336453u;
+    h = ((h >> ((h >> 28u) + 4u)) ^ h) * 277803737u;
+    h = (h >> 22u) ^ h;
+    return 0.02 + float(h & 0xffffu) / 65535.0 * 0.02;
+}
+
+// Distance travelled along the lane, from 0 at the entry end to roadLength at the exit
+float travel(float z, bool forward)
+{
+    return forward ? z + roadLength / 2.0 : roadLength / 2.0 - z;
+}
+
+void main()
+{
+    int lane = int(aState.z);
+    int flags = int(aState.w);
+    bool forward = (flags & 1) != 0;
+
+    // Cars are stored lane by lane in travel order, so the leader is always the next slot
+    int slot = gl_VertexID - lane * carsPerLane;
+    int leaderId = lane * carsPerLane + (slot + 1) % carsPerLane;
+    vec4 leader = texelFetch(trafficState, leaderId);
+
+    float s = travel(aState.x, forward);
+    float gap = carsPerLane > 1 ? mod(travel(leader.x, forward) - s, roadLength) : roadLength;
+
+    float speed = aState.y;
+    bool braking = gap < BRAKING_DISTANCE;
+    if (braking) {
+        speed *= 0.95; // Slow down
+    } else {
+        speed = cruiseSpeed(gl_VertexID); // Resume normal speed
+    }
+
+    // Clamp to the gap so the lane order is preserved and leader lookups stay valid
+    s = mod(s + min(speed, max(gap - MIN_GAP, 0.0)), roadLength);
+
+    float z = forward ? s - roadLength / 2.0 : roadLength / 2.0 - s;
+    outState = vec4(z, speed, aState.z, float((flags & 1) | (braking ? 2 : 0)));
+}
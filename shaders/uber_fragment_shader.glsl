@@ -0,0 +1,79 @@
+#version 330 core
+out vec4 FragColor;
+
+// Must match PulledMaterial
+const int MATERIAL_BUILDING = 0;
+const int MATERIAL_ROAD = 1;
+const int MATERIAL_CAR = 2;
+const int MATERIAL_WHEEL = 3;
+
+in vec3 FragPos;
+in vec3 ModelPos;
+in vec3 Normal;
+in vec2 TexCoords;
+in vec3 Color;
+flat in int Material;
+flat in int Flags;  // 1 moving forward, 2 braking, 4 headlights
+
+uniform sampler2D buildingTexture;
+uniform sampler2D roadTexture;
+
+// Ambient, diffuse and specular, as the building and car shaders light
+vec3 lit(vec3 albedo) {
+    vec3 ambient = 0.3 * lightColor;
+
+    vec3 norm = normalize(Normal);
+    vec3 lightDir = lightDirection(FragPos);
+    vec3 diffuse = max(dot(norm, lightDir), 0.0) * lightColor;
+
+    vec3 viewDir = normalize(cameraPos - FragPos);
+    vec3 reflectDir = reflect(-lightDir, norm);
+    vec3 specular = 0.5 * pow(max(dot(viewDir, reflectDir), 0.0), 32) * lightColor;
+
+#ifdef SUN_SHADOWS
+    float sun = sunVisibility(FragPos, norm);
+    diffuse *= sun;
+    specular *= sun;
+#endif
+#ifdef CAR_LIGHTS
+    diffuse += carLights(FragPos, norm);
+#endif
+
+    return (ambient + diffuse + specular) * albedo;
+}
+
+void main() {
+    if (Material == MATERIAL_ROAD) {
+        FragColor = texture(roadTexture, TexCoords);
+#ifdef SUN_SHADOWS
+        // Unlit, but darkened where a shadow falls
+        FragColor.rgb *= mix(0.5, 1.0, sunVisibility(FragPos, Normal));
+#endif
+#ifdef CAR_LIGHTS
+        FragColor.rgb += carLights(FragPos, Normal) * FragColor.rgb;
+#endif
+        return;
+    }
+
+    vec3 result;
+    if (Material == MATERIAL_BUILDING) {
+        result = lit(texture(buildingTexture, TexCoords).rgb);
+    } else {
+        result = lit(Color);
+    }
+
+    if (Material == MATERIAL_CAR) {
+        // Headlights at the front of the mesh (-z), brake lights at the back
+        if (ModelPos.z < -0.5 && (Flags & 4) != 0) {
+            result += vec3(1.0, 1.0, 0.8) * 0.5;
+        }
+        if (ModelPos.z > 0.5 && (Flags & 2) != 0) {
+            result += vec3(0.8, 0.0, 0.0) * 0.5;
+        }
+    }
+
+#ifdef FOG
+    result = applyFog(result, FragPos);
+#endif
+    FragColor = vec4(result, 1.0);
+}
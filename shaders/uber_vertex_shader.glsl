@@ -0,0 +1,46 @@
+#version 330 core
+// Every mesh of the pulled geometry (see pulled_geometry.h), with no vertex
+// attributes: the vertex and its instance are fetched from buffer textures
+
+// Must match PulledMaterial
+const int MATERIAL_BUILDING = 0;
+const int MATERIAL_ROAD = 1;
+const int MATERIAL_CAR = 2;
+const int MATERIAL_WHEEL = 3;
+
+uniform samplerBuffer meshData;      // Two texels per vertex: position and u, normal and v
+uniform samplerBuffer instanceData;      // Four per record: rows of the model matrix, colour and flags
+uniform isamplerBuffer instanceIndices;  // The records each draw covers, in lists
+uniform int firstIndex;                  // Of the draw's list, which gl_InstanceID counts from
+uniform int material;
+
+out vec3 FragPos;
+out vec3 ModelPos;  // Position on the mesh, for the lights at the ends of cars
+out vec3 Normal;
+out vec2 TexCoords;
+out vec3 Color;
+flat out int Material;
+flat out int Flags;
+
+void main() {
+    vec4 position = texelFetch(meshData, gl_VertexID * 2);
+    vec4 normal = texelFetch(meshData, gl_VertexID * 2 + 1);
+
+    int instance = texelFetch(instanceIndices, firstIndex + gl_InstanceID).r * 4;
+    mat4x3 model = transpose(mat3x4(texelFetch(instanceData, instance),
+                                    texelFetch(instanceData, instance + 1),
+                                    texelFetch(instanceData, instance + 2)));
+    vec4 appearance = texelFetch(instanceData, instance + 3);
+
+    FragPos = model * vec4(position.xyz, 1.0);
+    ModelPos = position.xyz;
+    // Models only rotate, translate and scale; meshes that are scaled unevenly
+    // are boxes, whose face normals keep their direction
+    Normal = mat3(model) * normal.xyz;
+    TexCoords = vec2(position.w, normal.w);
+    Color = material == MATERIAL_WHEEL ? vec3(0.1, 0.1, 0.1) : appearance.rgb;
+    Material = material;
+    Flags = int(appearance.a);
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -9,9 +9,6 @@ out vec2 TexCoords;
 out vec3 Normal;
 out vec3 FragPos;
 
-uniform mat4 view;
-uniform mat4 projection;
-
 void main()
 {
     vec3 scaledPos = aPos * aScale;
@@ -3,8 +3,6 @@
 layout (location = 0) in vec3 aPos; // Position attribute
 
 uniform mat4 model; // Model matrix
-uniform mat4 view;  // View matrix
-uniform mat4 projection; // Projection matrix
 
 void main()
 {
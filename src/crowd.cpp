@@ -0,0 +1,223 @@
+#include "crowd.h"
+#include "parallel.h"
+#include "traffic.h"
+#include <algorithm>
+#include <cmath>
+
+static const float PEDESTRIAN_MIN_SPEED = 0.004f;  // Units per tick, a fraction of the cars'
+static const float PEDESTRIAN_MAX_SPEED = 0.008f;
+static const float CROWD_PUSH = 0.05f;      // Strength of the separation
+static const float CROWD_BLOCKING = 4.0f;   // How much pedestrians close ahead slow one down
+static const float CROWD_LANE_WIDTH = (SIDEWALK_OUTER - SIDEWALK_INNER) / 2;  // Pedestrians keep right
+static const float CROWD_MAX_SIDESTEP = 0.01f;
+
+static const int CHUNK_CELLS = 2 * CROWD_CELLS;  // Both sidewalks of a street
+
+void initCrowd(Crowd& crowd, int capacity) {
+    crowd.perChunk = std::max(1, capacity / CROWD_CHUNKS);
+    int slots = crowd.perChunk * CROWD_CHUNKS;
+    for (int c = 0; c < CROWD_CHUNKS; c++) {
+        crowd.street[c] = 0;
+        crowd.count[c] = 0;
+    }
+    crowd.firstStreet = 1;
+    crowd.lastStreet = 0;
+
+    crowd.x.assign(slots, 0.0f);
+    crowd.z.assign(slots, 0.0f);
+    crowd.vx.assign(slots, 0.0f);
+    crowd.vz.assign(slots, 0.0f);
+    crowd.cruise.assign(slots, 0.0f);
+    crowd.sortedX.assign(slots, 0.0f);
+    crowd.sortedZ.assign(slots, 0.0f);
+    crowd.sortedVx.assign(slots, 0.0f);
+    crowd.sortedVz.assign(slots, 0.0f);
+    crowd.sortedCruise.assign(slots, 0.0f);
+    crowd.cellStart.assign(CROWD_CHUNKS * (CHUNK_CELLS + 1), 0);
+    crowd.cell.assign(slots, 0);
+}
+
+// Avenues are busier, and every other street gets a density of its own
+float crowdDensity(int street) {
+    if (wrapIndex(street, AVENUE_PERIOD) == 0) {
+        return 1.0f;
+    }
+    unsigned int h = trafficHash(static_cast<unsigned int>(street + 0x200000) + trafficSeed);
+    return 0.6f + static_cast<float>(h & 0xffffu) / 65535.0f * 0.4f;
+}
+
+static void spawnChunk(Crowd& crowd, int c, int street) {
+    int base = c * crowd.perChunk;
+    int count = static_cast<int>(crowd.perChunk * crowdDensity(street));
+    float middle = streetX(street);
+    unsigned int state = trafficHash(static_cast<unsigned int>(street) + trafficSeed);
+    for (int i = 0; i < count; i++) {
+        float side = (i & 1) ? 1.0f : -1.0f;
+        float direction = (unitRandom(state) < 0.5f) ? 1.0f : -1.0f;
+        crowd.x[base + i] = middle + side * (SIDEWALK_INNER + unitRandom(state) * (SIDEWALK_OUTER - SIDEWALK_INNER));
+        crowd.z[base + i] = -ROAD_LENGTH / 2 + unitRandom(state) * ROAD_LENGTH;
+        crowd.cruise[base + i] = direction * (PEDESTRIAN_MIN_SPEED + unitRandom(state) * (PEDESTRIAN_MAX_SPEED - PEDESTRIAN_MIN_SPEED));
+        crowd.vx[base + i] = 0.0f;
+        crowd.vz[base + i] = crowd.cruise[base + i];
+    }
+    crowd.street[c] = street;
+    crowd.count[c] = count;
+}
+
+void streamCrowd(Crowd& crowd, float cameraX) {
+    int first = static_cast<int>(floor((cameraX - CROWD_RADIUS + 30.0f) / STREET_SPACING));
+    int last = static_cast<int>(ceil((cameraX + CROWD_RADIUS + 30.0f) / STREET_SPACING));
+    while (first <= last && fabs(streetX(first) - cameraX) >= CROWD_RADIUS) first++;
+    while (last >= first && fabs(streetX(last) - cameraX) >= CROWD_RADIUS) last--;
+
+    for (int c = 0; c < CROWD_CHUNKS; c++) {
+        if (crowd.count[c] > 0 && (crowd.street[c] < first || crowd.street[c] > last)) {
+            crowd.count[c] = 0;
+        }
+    }
+    for (int street = first; street <= last; street++) {
+        if (street >= crowd.firstStreet && street <= crowd.lastStreet) {
+            continue;
+        }
+        for (int c = 0; c < CROWD_CHUNKS; c++) {
+            if (crowd.count[c] == 0) {
+                spawnChunk(crowd, c, street);
+                break;
+            }
+        }
+    }
+    crowd.firstStreet = first;
+    crowd.lastStreet = last;
+}
+
+// Cell of a position within its chunk: the sidewalk, then the distance along it
+static int sidewalkCell(float x, float z, float middle) {
+    int along = static_cast<int>(floor((z + ROAD_LENGTH / 2) / CROWD_CELL_LENGTH));
+    along = std::min(std::max(along, 0), CROWD_CELLS - 1);
+    return (x > middle ? CROWD_CELLS : 0) + along;
+}
+
+// Counting sort of a chunk's agents into the sorted arrays, by cell
+static void sortChunk(Crowd& crowd, int c) {
+    int base = c * crowd.perChunk;
+    int count = crowd.count[c];
+    float middle = streetX(crowd.street[c]);
+    int* start = &crowd.cellStart[c * (CHUNK_CELLS + 1)];
+    std::fill(start, start + CHUNK_CELLS + 1, 0);
+    for (int i = base; i < base + count; i++) {
+        crowd.cell[i] = sidewalkCell(crowd.x[i], crowd.z[i], middle);
+        start[crowd.cell[i] + 1]++;
+    }
+    for (int k = 1; k <= CHUNK_CELLS; k++) {
+        start[k] += start[k - 1];
+    }
+    for (int i = base; i < base + count; i++) {
+        int s = base + start[crowd.cell[i]]++;
+        crowd.sortedX[s] = crowd.x[i];
+        crowd.sortedZ[s] = crowd.z[i];
+        crowd.sortedVx[s] = crowd.vx[i];
+        crowd.sortedVz[s] = crowd.vz[i];
+        crowd.sortedCruise[s] = crowd.cruise[i];
+    }
+    // The scatter advanced every start to the next cell's; shift them back
+    for (int k = CHUNK_CELLS; k > 0; k--) {
+        start[k] = start[k - 1];
+    }
+    start[0] = 0;
+}
+
+// Steer and move the sorted agent i of chunk c, writing its new state back to slot i
+static void steerPedestrian(Crowd& crowd, int c, int i) {
+    int base = c * crowd.perChunk;
+    const int* start = &crowd.cellStart[c * (CHUNK_CELLS + 1)];
+    const float* otherX = &crowd.sortedX[base];
+    const float* otherZ = &crowd.sortedZ[base];
+    float middle = streetX(crowd.street[c]);
+    float px = crowd.sortedX[i];
+    float pz = crowd.sortedZ[i];
+    float cruise = crowd.sortedCruise[i];
+    float direction = (cruise >= 0.0f) ? 1.0f : -1.0f;
+    int cell = sidewalkCell(px, pz, middle);
+    int sidewalk = cell - cell % CROWD_CELLS;
+    int along = cell - sidewalk;
+
+    // Neighbours in this cell and the two either side along the sidewalk, which
+    // wraps with the road. Every agent in them is weighed, the agent itself
+    // included, as its offset of zero adds nothing, so the loop has no branches.
+    const float invSeparation2 = 1.0f / (PEDESTRIAN_SEPARATION * PEDESTRIAN_SEPARATION);
+    const float invLane2 = 4.0f / (CROWD_LANE_WIDTH * CROWD_LANE_WIDTH);
+    float pushX = 0.0f, pushZ = 0.0f, blocked = 0.0f;
+    for (int d = -1; d <= 1; d++) {
+        int k = along + d;
+        float shift = 0.0f;
+        if (k < 0) {
+            k += CROWD_CELLS;
+            shift = -ROAD_LENGTH;
+        } else if (k >= CROWD_CELLS) {
+            k -= CROWD_CELLS;
+            shift = ROAD_LENGTH;
+        }
+        int from = start[sidewalk + k];
+        int to = start[sidewalk + k + 1];
+        for (int j = from; j < to; j++) {
+            float dx = otherX[j] - px;
+            float dz = otherZ[j] + shift - pz;
+            float w = std::max(0.0f, 1.0f - (dx * dx + dz * dz) * invSeparation2);
+            pushX -= dx * w;
+            pushZ -= dz * w;
+            // Only those ahead in the same lane hold one up
+            float inLane = std::max(0.0f, 1.0f - dx * dx * invLane2);
+            blocked += static_cast<float>(dz * direction > 0.0f) * w * inLane;
+        }
+    }
+
+    // Walk on along the sidewalk, slowed by the crowd ahead, drifting back to
+    // the lane on the right, which is towards -x when walking towards +z
+    float side = (sidewalk == 0) ? -1.0f : 1.0f;
+    float laneX = middle + side * (SIDEWALK_INNER + SIDEWALK_OUTER) / 2 - direction * CROWD_LANE_WIDTH / 2;
+    float wantX = (laneX - px) * 0.02f + pushX * CROWD_PUSH;
+    float wantZ = cruise / (1.0f + blocked * CROWD_BLOCKING) + pushZ * CROWD_PUSH;
+    float vx = crowd.sortedVx[i] * 0.8f + wantX * 0.2f;
+    float vz = crowd.sortedVz[i] * 0.8f + wantZ * 0.2f;
+    vx = std::min(std::max(vx, -CROWD_MAX_SIDESTEP), CROWD_MAX_SIDESTEP);
+    vz = std::min(std::max(vz, -2.0f * PEDESTRIAN_MAX_SPEED), 2.0f * PEDESTRIAN_MAX_SPEED);
+
+    float inner = middle + side * SIDEWALK_INNER;
+    float outer = middle + side * SIDEWALK_OUTER;
+    float x = std::min(std::max(px + vx, std::min(inner, outer)), std::max(inner, outer));
+    float z = pz + vz;
+    if (z >= ROAD_LENGTH / 2) {
+        z -= ROAD_LENGTH;
+    } else if (z < -ROAD_LENGTH / 2) {
+        z += ROAD_LENGTH;
+    }
+
+    crowd.x[i] = x;
+    crowd.z[i] = z;
+    crowd.vx[i] = vx;
+    crowd.vz[i] = vz;
+    crowd.cruise[i] = cruise;
+}
+
+void updateCrowd(Crowd& crowd) {
+    parallelFor(CROWD_CHUNKS, [&crowd](int begin, int end) {
+        for (int c = begin; c < end; c++) {
+            if (crowd.count[c] > 0) {
+                sortChunk(crowd, c);
+            }
+        }
+    });
+
+    // Every agent reads the sorted snapshot and writes its own slot, so the
+    // slots are split evenly over the workers whatever the chunk sizes
+    int perChunk = crowd.perChunk;
+    parallelFor(perChunk * CROWD_CHUNKS, [&crowd, perChunk](int begin, int end) {
+        for (int c = begin / perChunk; c * perChunk < end; c++) {
+            int from = std::max(begin, c * perChunk);
+            int to = std::min(end, c * perChunk + crowd.count[c]);
+            for (int i = from; i < to; i++) {
+                steerPedestrian(crowd, c, i);
+            }
+        }
+    });
+}
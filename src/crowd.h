@@ -0,0 +1,50 @@
+#ifndef CROWD_H
+#define CROWD_H
+
+#include "road_graph.h"
+#include <vector>
+
+// Pedestrians on the sidewalks either side of the streets. Agents are stored
+// structure of arrays, one fixed chunk of slots per street near the camera,
+// and streamed in and out with the streets like the cars. Every tick each
+// chunk is sorted into a uniform grid of cells along its sidewalks, so the
+// neighbours of an agent sit in a few contiguous runs of the arrays and the
+// separation loop over them has no branches. All memory is allocated by
+// initCrowd(). Like traffic.h, no OpenGL here.
+
+const float CROWD_RADIUS = 50.0f;        // Streets closer than this to the camera have pedestrians; matches the far plane
+const int CROWD_CHUNKS = 25;             // One per street within CROWD_RADIUS
+const float SIDEWALK_INNER = 0.36f;      // Sidewalk edges, measured from the middle of the street
+const float SIDEWALK_OUTER = 0.48f;
+const float PEDESTRIAN_SEPARATION = 0.1f;  // Pedestrians closer than this push apart
+const int CROWD_CELLS = 600;  // Cells along one sidewalk
+const float CROWD_CELL_LENGTH = ROAD_LENGTH / CROWD_CELLS;  // No shorter than PEDESTRIAN_SEPARATION
+
+struct Crowd {
+    int perChunk;  // Slots per chunk
+    // Chunk c owns slots [c * perChunk, c * perChunk + count[c])
+    int street[CROWD_CHUNKS];
+    int count[CROWD_CHUNKS];  // 0 when the chunk is free
+    int firstStreet, lastStreet;
+
+    // Agent state, in the cell order of the previous tick
+    std::vector<float> x, z;
+    std::vector<float> vx, vz;
+    std::vector<float> cruise;  // Walking speed along z, signed by direction
+
+    // The same state sorted by cell, and the cells of each chunk: cells
+    // [c * 2 * CROWD_CELLS, (c + 1) * 2 * CROWD_CELLS) with the first sidewalk first
+    std::vector<float> sortedX, sortedZ, sortedVx, sortedVz, sortedCruise;
+    std::vector<int> cellStart;  // Start of each cell in its chunk's slots, plus an end marker per chunk
+    std::vector<int> cell;       // Scratch
+};
+
+void initCrowd(Crowd& crowd, int capacity);
+// Share of a chunk's slots the pedestrians of a street fill
+float crowdDensity(int street);
+// Fill the chunks of the streets coming within CROWD_RADIUS of cameraX and free the rest
+void streamCrowd(Crowd& crowd, float cameraX);
+// Advance every pedestrian by one tick, spread over the workers from parallel.h
+void updateCrowd(Crowd& crowd);
+
+#endif
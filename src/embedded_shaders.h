@@ -0,0 +1,40 @@
+#ifndef EMBEDDED_SHADERS_H
+#define EMBEDDED_SHADERS_H
+
+// The GLSL sources of shaders/, compiled into the executable by the CMake
+// step in cmake/embed_shaders.cmake. Names are the file names, such as
+// "car_vertex_shader.glsl".
+
+struct EmbeddedShader {
+    const char* name;
+    const char* source;
+};
+
+extern const EmbeddedShader EMBEDDED_SHADERS[];
+extern const int EMBEDDED_SHADER_COUNT;
+
+// Features a program can be built with. Each combination is its own variant,
+// compiled with the matching #defines so the shader has no runtime branches
+// for them.
+enum ShaderFeature {
+    SHADER_INSTANCING = 1 << 0,  // Per-instance placement from vertex attributes
+    SHADER_FOG = 1 << 1,         // Distance fog towards the horizon colour
+    SHADER_SHADOWS = 1 << 2,     // Sun shadows from the cascades of shadow_cascades.h
+    SHADER_HEIGHTFIELD_SHADOWS = 1 << 3,  // Sun shadows marched through the building heights instead
+    SHADER_CAR_LIGHTS = 1 << 4            // Car headlights and brake lights from the clusters of light_clusters.h
+};
+
+struct ShaderFeatureDefine {
+    unsigned feature;
+    const char* define;
+};
+
+const ShaderFeatureDefine SHADER_FEATURE_DEFINES[] = {
+    {SHADER_INSTANCING, "INSTANCING"},
+    {SHADER_FOG, "FOG"},
+    {SHADER_SHADOWS, "SHADOWS"},
+    {SHADER_HEIGHTFIELD_SHADOWS, "HEIGHTFIELD_SHADOWS"},
+    {SHADER_CAR_LIGHTS, "CAR_LIGHTS"},
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include "flying_traffic.h"
+#include "parallel.h"
+#include "traffic.h"
+#include <algorithm>
+#include <cmath>
+
+static const float FLYER_LOOKAHEAD = 3.0f;  // Distance ahead checked for buildings
+static const long FLYER_REORDER_TICKS = 64;  // Flyers drift apart from their memory neighbours slowly
+
+float flyerBandAltitude(int band) {
+    return FLYER_BASE_ALTITUDE + band * FLYER_BAND_SPACING;
+}
+
+// Lanes alternate direction like the streets below
+glm::vec3 flyerLaneDirection(int band, float across) {
+    int lane = static_cast<int>(floor(across / FLYER_LANE_SPACING + 0.5f));
+    float sign = (wrapIndex(lane, 2) == 0) ? 1.0f : -1.0f;
+    return (band % 2 == 0) ? glm::vec3(sign, 0.0f, 0.0f) : glm::vec3(0.0f, 0.0f, sign);
+}
+
+static const float FLYER_LANE_SLACK = 0.4f * FLYER_LANE_SPACING;  // How far a flyer may stray from its lane
+
+// Coordinate across the lanes of a band, and the lane centre nearest to it
+static float acrossLanes(const Flyer& flyer) {
+    return (flyer.band % 2 == 0) ? flyer.position.z : flyer.position.x;
+}
+
+static float laneCentre(float across) {
+    return floor(across / FLYER_LANE_SPACING + 0.5f) * FLYER_LANE_SPACING;
+}
+
+void initFlyingTraffic(FlyingTraffic& traffic, int count, glm::vec3 center, unsigned int seed) {
+    traffic.flyers.resize(count);
+    unsigned int state = seed ^ 0x5f3759dfu;
+    for (int i = 0; i < count; i++) {
+        Flyer& flyer = traffic.flyers[i];
+        flyer.band = i % FLYER_BANDS;
+        flyer.position.x = center.x + (unitRandom(state) - 0.5f) * FLYER_AREA;
+        flyer.position.z = center.z + (unitRandom(state) - 0.5f) * FLYER_AREA;
+        flyer.position.y = flyerBandAltitude(flyer.band);
+        flyer.lane = laneCentre(acrossLanes(flyer));
+        if (flyer.band % 2 == 0) {
+            flyer.position.z = flyer.lane;
+        } else {
+            flyer.position.x = flyer.lane;
+        }
+        flyer.cruiseSpeed = 0.05f + unitRandom(state) * 0.04f;
+        flyer.velocity = flyerLaneDirection(flyer.band, flyer.lane) * flyer.cruiseSpeed;
+    }
+    initSpatialHash(traffic.hash, 2.0f * FLYER_SEPARATION, count);
+    traffic.ticks = 0;
+}
+
+float buildingHeightAt(const FlyerHeightField& field, float x, float z) {
+    if (field.heights.empty()) {
+        return 0.0f;
+    }
+    // One division per axis; wrapIndex() would take two
+    int i = static_cast<int>(floor((x - field.origin.x) / field.cellSize + 0.5f)) % field.width;
+    int j = static_cast<int>(floor((z - field.origin.y) / field.cellSize + 0.5f)) % field.depth;
+    i += (i < 0) ? field.width : 0;
+    j += (j < 0) ? field.depth : 0;
+    return field.heights[i * field.depth + j];
+}
+
+// New velocity of one flyer, from the positions of its neighbours this tick
+static glm::vec3 steerFlyer(const FlyingTraffic& traffic, int index) {
+    const Flyer& flyer = traffic.flyers[index];
+    float across = acrossLanes(flyer);
+    glm::vec3 direction = flyerLaneDirection(flyer.band, flyer.lane);
+    glm::vec3 side(direction.z, 0.0f, -direction.x);
+
+    // Slow down behind close flyers and sidestep the ones close alongside
+    float speedScale = 1.0f;
+    float push = 0.0f;
+    glm::vec3 reach(FLYER_SEPARATION);
+    querySpatialHash(traffic.hash, flyer.position - reach, flyer.position + reach,
+                     [&flyer, index, direction, side, &speedScale, &push](int other, const glm::vec3& position) {
+        if (other == index) {
+            return;
+        }
+        glm::vec3 d = position - flyer.position;
+        float distance2 = glm::dot(d, d);
+        if (fabs(d.y) > FLYER_BAND_SPACING / 2 || distance2 >= FLYER_SEPARATION * FLYER_SEPARATION) {
+            return;
+        }
+        float distance = sqrt(distance2);
+        if (glm::dot(d, direction) > 0.0f) {
+            speedScale = std::min(speedScale, distance / FLYER_SEPARATION);
+        }
+        float sideways = glm::dot(d, side);
+        push -= (sideways >= 0.0f ? 1.0f : -1.0f) * (FLYER_SEPARATION - distance) * 0.01f;
+    });
+
+    // Along the lane, sideways back towards its centre, and up over the buildings
+    float alongSpeed = flyer.cruiseSpeed * std::max(speedScale, 0.1f);
+    float axis = (flyer.band % 2 == 0) ? side.z : side.x;  // +1 when side points up the across axis
+    float offset = (across - flyer.lane) * axis;
+    float sideSpeed = glm::dot(flyer.velocity, side) * 0.9f + push - offset * 0.01f;
+    sideSpeed = std::min(std::max(sideSpeed, -FLYER_LANE_SLACK - offset), FLYER_LANE_SLACK - offset);
+
+    glm::vec3 ahead = flyer.position + direction * FLYER_LOOKAHEAD;
+    float clearance = std::max(buildingHeightAt(traffic.heightField, flyer.position.x, flyer.position.z),
+                               buildingHeightAt(traffic.heightField, ahead.x, ahead.z)) + FLYER_CLEARANCE;
+    float target = std::max(flyerBandAltitude(flyer.band), clearance);
+    float climb = std::min(std::max((target - flyer.position.y) * 0.1f, -0.05f), 0.1f);
+
+    return direction * alongSpeed + side * sideSpeed + glm::vec3(0.0f, climb, 0.0f);
+}
+
+// Shift that keeps a coordinate within FLYER_AREA/2 of the centre; FLYER_AREA
+// spans an even number of lanes, so a wrapped flyer keeps its lane direction
+static float wrapShift(float value, float centre) {
+    if (value - centre > FLYER_AREA / 2) {
+        return -FLYER_AREA;
+    } else if (value - centre < -FLYER_AREA / 2) {
+        return FLYER_AREA;
+    }
+    return 0.0f;
+}
+
+void updateFlyingTraffic(FlyingTraffic& traffic, glm::vec3 center) {
+    int count = static_cast<int>(traffic.flyers.size());
+    if (count == 0) {
+        return;
+    }
+    buildSpatialHash(traffic.hash, &traffic.flyers[0].position, count, sizeof(Flyer));
+
+    // Store the flyers in bucket order every so often. The steering below walks
+    // them in bucket order, which then reads and writes memory front to back.
+    if (traffic.ticks++ % FLYER_REORDER_TICKS == 0) {
+        traffic.reordered.resize(count);
+        for (int e = 0; e < count; e++) {
+            traffic.reordered[e] = traffic.flyers[traffic.hash.entries[e]];
+            traffic.hash.entries[e] = e;
+        }
+        traffic.flyers.swap(traffic.reordered);
+    }
+
+    // Neighbours are read from the copy of the positions in the hash, so every
+    // flyer steers against the same snapshot and can move straight away.
+    // Flyers go in bucket order, so neighbouring flyers look at the same few
+    // buckets one after the other.
+    parallelFor(count, [&traffic, center](int begin, int end) {
+        for (int e = begin; e < end; e++) {
+            int i = traffic.hash.entries[e];
+            Flyer& flyer = traffic.flyers[i];
+            flyer.velocity = steerFlyer(traffic, i);
+            flyer.position += flyer.velocity;
+
+            float shiftX = wrapShift(flyer.position.x, center.x);
+            float shiftZ = wrapShift(flyer.position.z, center.z);
+            flyer.position.x += shiftX;
+            flyer.position.z += shiftZ;
+            flyer.lane += (flyer.band % 2 == 0) ? shiftZ : shiftX;
+        }
+    });
+}
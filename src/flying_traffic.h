@@ -0,0 +1,55 @@
+#ifndef FLYING_TRAFFIC_H
+#define FLYING_TRAFFIC_H
+
+#include "spatial_hash.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+// Flying traffic in altitude bands above the city. Each band is a set of
+// parallel one-way lanes; bands alternate between running along x and along z.
+// Flyers keep their distance from each other through a spatial hash and climb
+// over buildings that reach into their band. Like traffic.h, no OpenGL here.
+
+const int FLYER_BANDS = 4;
+const float FLYER_BASE_ALTITUDE = 6.0f;   // Band 0 flies among the taller buildings
+const float FLYER_BAND_SPACING = 2.0f;
+const float FLYER_LANE_SPACING = 2.0f;
+const float FLYER_AREA = 240.0f;          // Flyers wrap around a square this wide centred on the camera
+const float FLYER_SEPARATION = 1.0f;      // Flyers closer than this ahead slow down and sidestep
+const float FLYER_CLEARANCE = 1.0f;       // Height kept above building tops
+
+// Building heights on a periodic grid: cell (i, j) is centred on
+// origin + (i, j) * cellSize and the grid repeats every width x depth cells
+struct FlyerHeightField {
+    glm::vec2 origin;
+    float cellSize;
+    int width;
+    int depth;
+    std::vector<float> heights;  // heights[i * depth + j]
+};
+
+struct Flyer {
+    glm::vec3 position;
+    glm::vec3 velocity;
+    float cruiseSpeed;
+    int band;
+    float lane;  // Coordinate of the lane centre across the band
+};
+
+struct FlyingTraffic {
+    std::vector<Flyer> flyers;   // Reordered by bucket now and then, so neighbours share cache lines
+    FlyerHeightField heightField;
+    SpatialHash hash;
+    long ticks;
+    std::vector<Flyer> reordered;  // Scratch for the reordering
+};
+
+float flyerBandAltitude(int band);
+glm::vec3 flyerLaneDirection(int band, float across);
+
+void initFlyingTraffic(FlyingTraffic& traffic, int count, glm::vec3 center, unsigned int seed);
+float buildingHeightAt(const FlyerHeightField& field, float x, float z);
+// Advance every flyer by one tick, spread over the workers from parallel.h
+void updateFlyingTraffic(FlyingTraffic& traffic, glm::vec3 center);
+
+#endif
@@ -0,0 +1,81 @@
+#include "gl_state.h"
+
+static const int TRACKED_UNITS = 16;  // The minimum GL 3.3 guarantees for fragment shaders
+
+static GLuint currentProgram = 0;
+static GLuint currentVertexArray = 0;
+static int currentUnit = 0;
+static GLuint currentTexture2D[TRACKED_UNITS];
+static GLuint currentTextureBuffer[TRACKED_UNITS];
+static GlStateCounters counters = {0, 0};
+
+// Compare a binding with its shadow and update it; true when GL has to be called
+static bool changeBinding(GLuint& current, GLuint value) {
+    if (current == value) {
+        counters.skipped++;
+        return false;
+    }
+    current = value;
+    counters.calls++;
+    return true;
+}
+
+void bindProgram(GLuint program) {
+    if (changeBinding(currentProgram, program)) {
+        glUseProgram(program);
+    }
+}
+
+void bindVertexArray(GLuint vertexArray) {
+    if (changeBinding(currentVertexArray, vertexArray)) {
+        glBindVertexArray(vertexArray);
+    }
+}
+
+void activeTextureUnit(GLenum unit) {
+    GLuint current = static_cast<GLuint>(currentUnit);
+    if (changeBinding(current, unit - GL_TEXTURE0)) {
+        currentUnit = static_cast<int>(current);
+        glActiveTexture(unit);
+    }
+}
+
+void bindTexture(GLenum target, GLuint texture) {
+    GLuint* current = 0;
+    if (currentUnit < TRACKED_UNITS) {
+        if (target == GL_TEXTURE_2D) {
+            current = &currentTexture2D[currentUnit];
+        } else if (target == GL_TEXTURE_BUFFER) {
+            current = &currentTextureBuffer[currentUnit];
+        }
+    }
+    if (!current) {
+        counters.calls++;
+        glBindTexture(target, texture);
+    } else if (changeBinding(*current, texture)) {
+        glBindTexture(target, texture);
+    }
+}
+
+void forgetProgram(GLuint program) {
+    if (currentProgram == program) {
+        currentProgram = 0;
+    }
+}
+
+GlStateCounters takeGlStateCounters() {
+    GlStateCounters taken = counters;
+    counters.calls = 0;
+    counters.skipped = 0;
+    return taken;
+}
+
+void createBufferTexture(GLuint& buffer, GLuint& texture, GLenum format) {
+    glGenBuffers(1, &buffer);
+    glGenTextures(1, &texture);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    bindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+    bindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
@@ -0,0 +1,31 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <GL/glew.h>
+
+// Shadow of the GL binding state: the program in use, the vertex array, the
+// active texture unit and the 2D and buffer textures bound to each unit.
+// Binding what is already bound returns without calling GL. Everything that
+// binds these must go through here, or the shadow goes stale. Draws leave
+// their vertex array bound; the next one rebinds only if it differs.
+
+struct GlStateCounters {
+    int calls;    // Binds that reached GL
+    int skipped;  // Binds elided because nothing would change
+};
+
+void bindProgram(GLuint program);
+void bindVertexArray(GLuint vertexArray);
+void activeTextureUnit(GLenum unit);
+void bindTexture(GLenum target, GLuint texture);  // On the active unit
+
+// A buffer with a buffer texture over it in format, both left unbound
+void createBufferTexture(GLuint& buffer, GLuint& texture, GLenum format);
+
+// A deleted program that is in use is unbound by GL; keep the shadow in step
+void forgetProgram(GLuint program);
+
+// Counters since the last call, which clears them
+GlStateCounters takeGlStateCounters();
+
+#endif
@@ -0,0 +1,87 @@
+#include "instance_store.h"
+#include "gl_state.h"
+#include <algorithm>
+
+void createInstanceStore(InstanceStore& store, int texelsPerInstance, int persistentCount) {
+    store.texelsPerInstance = texelsPerInstance;
+    store.persistentCount = persistentCount;
+    store.records.assign(static_cast<size_t>(persistentCount) * texelsPerInstance, glm::vec4(0.0f));
+    store.indices.clear();
+    store.dirtyFirst = 0;
+    store.dirtyLast = persistentCount - 1;
+    store.recordCapacity = 0;
+    createBufferTexture(store.recordBuffer, store.recordTexture, GL_RGBA32F);
+    createBufferTexture(store.indexBuffer, store.indexTexture, GL_R32I);
+}
+
+void deleteInstanceStore(InstanceStore& store) {
+    glDeleteTextures(1, &store.recordTexture);
+    glDeleteTextures(1, &store.indexTexture);
+    glDeleteBuffers(1, &store.recordBuffer);
+    glDeleteBuffers(1, &store.indexBuffer);
+}
+
+glm::vec4* persistentInstance(InstanceStore& store, int instance) {
+    if (store.dirtyFirst > store.dirtyLast) {
+        store.dirtyFirst = store.dirtyLast = instance;
+    } else {
+        store.dirtyFirst = std::min(store.dirtyFirst, instance);
+        store.dirtyLast = std::max(store.dirtyLast, instance);
+    }
+    return &store.records[static_cast<size_t>(instance) * store.texelsPerInstance];
+}
+
+int addTransientInstance(InstanceStore& store, const glm::vec4* texels) {
+    int instance = static_cast<int>(store.records.size() / store.texelsPerInstance);
+    store.records.insert(store.records.end(), texels, texels + store.texelsPerInstance);
+    return instance;
+}
+
+int instanceIndexCount(const InstanceStore& store) {
+    return static_cast<int>(store.indices.size());
+}
+
+void addInstanceIndex(InstanceStore& store, int instance) {
+    store.indices.push_back(instance);
+}
+
+void uploadInstanceStore(InstanceStore& store) {
+    size_t stride = store.texelsPerInstance;
+    size_t persistentTexels = store.persistentCount * stride;
+
+    glBindBuffer(GL_TEXTURE_BUFFER, store.recordBuffer);
+    if (store.records.size() > store.recordCapacity) {
+        // Grow with room to spare, which sends the persistent records again
+        store.recordCapacity = store.records.size() + store.records.size() / 2;
+        glBufferData(GL_TEXTURE_BUFFER, store.recordCapacity * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+        store.dirtyFirst = 0;
+        store.dirtyLast = store.persistentCount - 1;
+    }
+    if (store.dirtyFirst <= store.dirtyLast) {
+        glBufferSubData(GL_TEXTURE_BUFFER, store.dirtyFirst * stride * sizeof(glm::vec4),
+                        (store.dirtyLast - store.dirtyFirst + 1) * stride * sizeof(glm::vec4),
+                        &store.records[store.dirtyFirst * stride]);
+    }
+    if (store.records.size() > persistentTexels) {
+        glBufferSubData(GL_TEXTURE_BUFFER, persistentTexels * sizeof(glm::vec4),
+                        (store.records.size() - persistentTexels) * sizeof(glm::vec4), &store.records[persistentTexels]);
+    }
+
+    // The lists change completely every frame; orphan the previous ones
+    glBindBuffer(GL_TEXTURE_BUFFER, store.indexBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, store.indices.size() * sizeof(GLint), store.indices.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    store.records.resize(persistentTexels);
+    store.indices.clear();
+    store.dirtyFirst = 1;
+    store.dirtyLast = 0;
+}
+
+void bindInstanceStore(const InstanceStore& store, GLenum recordUnit, GLenum indexUnit) {
+    activeTextureUnit(recordUnit);
+    bindTexture(GL_TEXTURE_BUFFER, store.recordTexture);
+    activeTextureUnit(indexUnit);
+    bindTexture(GL_TEXTURE_BUFFER, store.indexTexture);
+    activeTextureUnit(GL_TEXTURE0);
+}
@@ -0,0 +1,54 @@
+#ifndef INSTANCE_STORE_H
+#define INSTANCE_STORE_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Instance records in a buffer texture, read by shaders with texelFetch()
+// rather than through attribute divisors, so every instanced type picks its
+// own record size and a draw can cover any subset of the records. A draw reads
+// a list of record numbers from a second buffer texture, starting at an
+// offset uniform and indexed by gl_InstanceID:
+//
+//   int record = texelFetch(instanceIndices, firstIndex + gl_InstanceID).r;
+//   vec4 texel = texelFetch(instanceData, record * texelsPerInstance + k);
+//
+// Culling a draw then writes one integer per visible instance instead of
+// copying whole records.
+//
+// The first records are persistent: they keep their place between frames and
+// only the range written since the last upload is sent again. Records after
+// them are transient and cleared by every upload, along with the index lists.
+
+struct InstanceStore {
+    int texelsPerInstance;
+    int persistentCount;
+    std::vector<glm::vec4> records;
+    std::vector<GLint> indices;  // The frame's index lists, back to back
+    int dirtyFirst, dirtyLast;   // Persistent records written since the last upload
+    size_t recordCapacity;       // Texels the record buffer has room for
+    GLuint recordBuffer, recordTexture;
+    GLuint indexBuffer, indexTexture;
+};
+
+void createInstanceStore(InstanceStore& store, int texelsPerInstance, int persistentCount);
+void deleteInstanceStore(InstanceStore& store);
+
+// The texels of a persistent record, to be written in full
+glm::vec4* persistentInstance(InstanceStore& store, int instance);
+
+// Append a transient record and return its number
+int addTransientInstance(InstanceStore& store, const glm::vec4* texels);
+
+// Index lists: note instanceIndexCount() as the list's firstIndex, add the
+// records to draw, and draw the difference as the instance count
+int instanceIndexCount(const InstanceStore& store);
+void addInstanceIndex(InstanceStore& store, int instance);
+
+// Upload what changed this frame, then clear the transient records and the
+// index lists; before the draws that read them are submitted
+void uploadInstanceStore(InstanceStore& store);
+void bindInstanceStore(const InstanceStore& store, GLenum recordUnit, GLenum indexUnit);
+
+#endif
@@ -0,0 +1,153 @@
+#include "light_clusters.h"
+#include "gl_state.h"
+#include <algorithm>
+#include <cmath>
+
+static const int LIGHT_TEXELS = 3;
+
+void createLightClusters(LightClusters& clusters, int tilesX, int tilesY, int slices, float nearPlane,
+                         float farPlane) {
+    clusters.tilesX = tilesX;
+    clusters.tilesY = tilesY;
+    clusters.slices = slices;
+    clusters.nearPlane = nearPlane;
+    clusters.farPlane = farPlane;
+    clusters.sliceScale = slices / log(farPlane / nearPlane);
+    clusters.sliceBias = -log(nearPlane) * clusters.sliceScale;
+    clusters.ranges.assign(static_cast<size_t>(tilesX) * tilesY * slices * 2, 0);
+    createBufferTexture(clusters.lightBuffer, clusters.lightTexture, GL_RGBA32F);
+    createBufferTexture(clusters.rangeBuffer, clusters.rangeTexture, GL_RG32I);
+    createBufferTexture(clusters.indexBuffer, clusters.indexTexture, GL_R32I);
+}
+
+void deleteLightClusters(LightClusters& clusters) {
+    glDeleteTextures(1, &clusters.lightTexture);
+    glDeleteTextures(1, &clusters.rangeTexture);
+    glDeleteTextures(1, &clusters.indexTexture);
+    glDeleteBuffers(1, &clusters.lightBuffer);
+    glDeleteBuffers(1, &clusters.rangeBuffer);
+    glDeleteBuffers(1, &clusters.indexBuffer);
+}
+
+void clearClusterLights(LightClusters& clusters) {
+    clusters.lights.clear();
+}
+
+void addClusterLight(LightClusters& clusters, const glm::vec3& position, float radius, const glm::vec3& color,
+                     const glm::vec3& direction, float coneCosine) {
+    clusters.lights.push_back(glm::vec4(position, radius));
+    clusters.lights.push_back(glm::vec4(color, coneCosine));
+    clusters.lights.push_back(glm::vec4(direction, 0.0f));
+}
+
+int clusterLightCount(const LightClusters& clusters) {
+    return static_cast<int>(clusters.lights.size() / LIGHT_TEXELS);
+}
+
+// The tiles covering [low, high] in normalised device coordinates, or false
+// when that misses the screen
+static bool tileSpan(float low, float high, int tiles, int& first, int& last) {
+    if (high < -1.0f || low > 1.0f) {
+        return false;
+    }
+    first = std::max(0, static_cast<int>(floor((low * 0.5f + 0.5f) * tiles)));
+    last = std::min(tiles - 1, static_cast<int>(floor((high * 0.5f + 0.5f) * tiles)));
+    return true;
+}
+
+// Bounds of x / depth over a box, by the corner nearest the camera on each
+// side; depths start at the near plane so the bounds stay finite
+static void projectedSpan(float low, float high, float nearDepth, float farDepth, float& spanLow, float& spanHigh) {
+    spanLow = low < 0.0f ? low / nearDepth : low / farDepth;
+    spanHigh = high > 0.0f ? high / nearDepth : high / farDepth;
+}
+
+void assignLightClusters(LightClusters& clusters, const glm::mat4& view, const glm::mat4& projection) {
+    int lightCount = clusterLightCount(clusters);
+    int clusterCount = clusters.tilesX * clusters.tilesY * clusters.slices;
+    std::fill(clusters.ranges.begin(), clusters.ranges.end(), 0);
+    clusters.bounds.resize(static_cast<size_t>(lightCount) * 6);
+
+    // Count the lights of each cluster, keeping each light's cluster box
+    for (int i = 0; i < lightCount; i++) {
+        const glm::vec4& light = clusters.lights[i * LIGHT_TEXELS];
+        int* box = &clusters.bounds[i * 6];
+        box[0] = 1;
+        box[3] = 0;  // Empty unless it reaches the frustum
+
+        glm::vec3 center = glm::vec3(view * glm::vec4(glm::vec3(light), 1.0f));
+        float radius = light.w;
+        float nearDepth = std::max(-center.z - radius, clusters.nearPlane);
+        float farDepth = -center.z + radius;
+        if (farDepth < clusters.nearPlane || nearDepth > clusters.farPlane) {
+            continue;
+        }
+
+        float xLow, xHigh, yLow, yHigh;
+        projectedSpan(center.x - radius, center.x + radius, nearDepth, farDepth, xLow, xHigh);
+        projectedSpan(center.y - radius, center.y + radius, nearDepth, farDepth, yLow, yHigh);
+        if (!tileSpan(xLow * projection[0][0], xHigh * projection[0][0], clusters.tilesX, box[0], box[3]) ||
+            !tileSpan(yLow * projection[1][1], yHigh * projection[1][1], clusters.tilesY, box[1], box[4])) {
+            box[0] = 1;
+            box[3] = 0;
+            continue;
+        }
+        box[2] = std::max(0, static_cast<int>(floor(log(nearDepth) * clusters.sliceScale + clusters.sliceBias)));
+        box[5] = std::min(clusters.slices - 1,
+                          static_cast<int>(floor(log(farDepth) * clusters.sliceScale + clusters.sliceBias)));
+
+        for (int z = box[2]; z <= box[5]; z++) {
+            for (int y = box[1]; y <= box[4]; y++) {
+                int row = (z * clusters.tilesY + y) * clusters.tilesX;
+                for (int x = box[0]; x <= box[3]; x++) {
+                    clusters.ranges[(row + x) * 2 + 1]++;
+                }
+            }
+        }
+    }
+
+    // Turn the counts into starting offsets, then write the lights out with
+    // the counts rebuilt as they go
+    int total = 0;
+    for (int c = 0; c < clusterCount; c++) {
+        clusters.ranges[c * 2] = total;
+        total += clusters.ranges[c * 2 + 1];
+        clusters.ranges[c * 2 + 1] = 0;
+    }
+    clusters.indices.resize(total);
+    for (int i = 0; i < lightCount; i++) {
+        const int* box = &clusters.bounds[i * 6];
+        for (int z = box[2]; z <= box[5] && box[0] <= box[3]; z++) {
+            for (int y = box[1]; y <= box[4]; y++) {
+                int row = (z * clusters.tilesY + y) * clusters.tilesX;
+                for (int x = box[0]; x <= box[3]; x++) {
+                    GLint* range = &clusters.ranges[(row + x) * 2];
+                    clusters.indices[range[0] + range[1]++] = i;
+                }
+            }
+        }
+    }
+}
+
+void uploadLightClusters(LightClusters& clusters) {
+    // Everything changes every frame; orphan the previous frame's buffers
+    glBindBuffer(GL_TEXTURE_BUFFER, clusters.lightBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, clusters.lights.size() * sizeof(glm::vec4), clusters.lights.data(),
+                 GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, clusters.rangeBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, clusters.ranges.size() * sizeof(GLint), clusters.ranges.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, clusters.indexBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, clusters.indices.size() * sizeof(GLint), clusters.indices.data(),
+                 GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void bindLightClusters(const LightClusters& clusters, GLenum lightUnit, GLenum rangeUnit, GLenum indexUnit) {
+    activeTextureUnit(lightUnit);
+    bindTexture(GL_TEXTURE_BUFFER, clusters.lightTexture);
+    activeTextureUnit(rangeUnit);
+    bindTexture(GL_TEXTURE_BUFFER, clusters.rangeTexture);
+    activeTextureUnit(indexUnit);
+    bindTexture(GL_TEXTURE_BUFFER, clusters.indexTexture);
+    activeTextureUnit(GL_TEXTURE0);
+}
@@ -0,0 +1,53 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Clustered forward lighting for many small point and spot lights. The view
+// frustum is cut into a grid of clusters, tiles across the screen and slices
+// of view depth that grow exponentially with distance, and every frame each
+// light is listed in the clusters its sphere of influence overlaps. A fragment
+// works out its cluster from its position and loops over only that list:
+//
+//   ivec2 range = texelFetch(lightClusters, cluster).xy;  // first index, count
+//   int light = texelFetch(lightIndices, range.x + i).r;
+//
+// The lights, the ranges and the lists live in three buffer textures. A light
+// is three texels: position and radius, colour and the cosine of its spot
+// cone, and the direction it faces. A cone cosine of -1 makes a point light.
+//
+// The lists are built with a counting sort: the clusters each light overlaps
+// are counted, the counts summed into starting offsets, and the lights written
+// out, so the frame's work grows with the lights and not with the grid.
+
+struct LightClusters {
+    int tilesX, tilesY, slices;
+    float nearPlane, farPlane;
+    float sliceScale, sliceBias;   // slice = log(depth) * sliceScale + sliceBias
+    std::vector<glm::vec4> lights; // The frame's lights, three texels each
+    std::vector<int> bounds;       // Cluster box of each light: x, y, slice low, then high
+    std::vector<GLint> ranges;     // First index and count of each cluster
+    std::vector<GLint> indices;    // Light numbers, cluster by cluster
+    GLuint lightBuffer, lightTexture;
+    GLuint rangeBuffer, rangeTexture;
+    GLuint indexBuffer, indexTexture;
+};
+
+void createLightClusters(LightClusters& clusters, int tilesX, int tilesY, int slices, float nearPlane,
+                         float farPlane);
+void deleteLightClusters(LightClusters& clusters);
+
+void clearClusterLights(LightClusters& clusters);
+void addClusterLight(LightClusters& clusters, const glm::vec3& position, float radius, const glm::vec3& color,
+                     const glm::vec3& direction, float coneCosine);
+int clusterLightCount(const LightClusters& clusters);
+
+// List the frame's lights in the clusters of a symmetric perspective
+// projection, then upload the lights and the lists
+void assignLightClusters(LightClusters& clusters, const glm::mat4& view, const glm::mat4& projection);
+void uploadLightClusters(LightClusters& clusters);
+void bindLightClusters(const LightClusters& clusters, GLenum lightUnit, GLenum rangeUnit, GLenum indexUnit);
+
+#endif
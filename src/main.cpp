@@ -4,6 +4,21 @@
 #include <iostream>
 #include <vector>
 #include "stb_image.h"
+#include "traffic.h"
+#include "traffic_replay.h"
+#include "traffic_signals.h"
+#include "flying_traffic.h"
+#include "crowd.h"
+#include "parallel.h"
+#include "shader_program.h"
+#include "gl_state.h"
+#include "render_queue.h"
+#include "program_cache.h"
+#include "shader_compiler.h"
+#include "pulled_geometry.h"
+#include "shadow_cascades.h"
+#include "light_clusters.h"
+#include "embedded_shaders.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -14,6 +29,12 @@
 #include <string>
 #include <chrono>
 #include <thread>
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <map>
+#include <cstddef> // For offsetof
+#include <cstring> // For memcpy
 
 struct InstanceData
 {
@@ -21,16 +42,6 @@ struct InstanceData
     glm::vec3 scale;
 };
 
-struct Car {
-    glm::vec3 position;
-    float speed;
-    glm::vec3 color;
-    bool movingForward;
-    bool brakingLights;  // New: for brake lights effect
-    float headlightIntensity; // New: for headlight glow
-};
-
-
 struct XWing {
     glm::vec3 position;
     glm::vec3 color;
@@ -40,17 +51,38 @@ struct XWing {
 int windowWidth = 1080;
 int windowHeight = 800;
 glm::mat4 projection;
+const float FAR_PLANE = 50.0f;
 glm::vec3 lightPos(5.0f, 10.0f, 5.0f);
 glm::vec3 lightColor(1.0f, 1.0f, 1.0f);
+RenderQueue renderQueue;  // Draws of the frame, submitted in key order after everything is queued
 
 XWing xwing;
 GLuint xwingVAO, xwingVBO;
 
+// Flying traffic: X-wings on the altitude bands above the buildings, drawn
+// with the player's mesh in one instanced call
+const int NUM_FLYERS = 100000;
+const float FLYER_DRAW_DISTANCE = 50.0f;  // Matches the far plane
+bool useFlyingTraffic = false;
+int flyerCount = NUM_FLYERS;
+FlyingTraffic flyingTraffic;
+std::vector<glm::vec4> flyerInstances;  // position, heading
+GLuint flyerVAO, flyerInstanceVBO;
+ShaderProgram flyerShaderProgram;
+
+// Pedestrians on the sidewalks, drawn as low-poly figures in one instanced call
+const int NUM_PEDESTRIANS = 50000;
+const float PEDESTRIAN_DRAW_DISTANCE = 20.0f;  // Figures are too small to make out further away
+bool usePedestrians = false;
+int pedestrianCount = NUM_PEDESTRIANS;
+Crowd crowd;
+std::vector<glm::vec4> pedestrianInstances;  // x, z, heading, walking speed
+GLuint pedestrianVAO, pedestrianVBO, pedestrianInstanceVBO;
+ShaderProgram pedestrianShaderProgram;
+
 
 
 const int NUM_STREETS = 15;  // Number of vertical streets
-const int CARS_PER_STREET = 4;  // Number of cars per street
-const float STREET_SPACING = 4.0f;  // Space between streets
 
 glm::vec3 cameraPos(0.0f, 5.0f, 10.0f);
 float cameraSpeed = 0.05f;                             // Reduced speed
@@ -63,8 +95,8 @@ float buildingHeights[gridSizeX][gridSizeZ];
 
 float xOffset[gridSizeX]; // Track X offset for each column
 
-GLuint skyboxVAO, skyboxVBO;
-GLuint skyboxShaderProgram;
+GLuint skyboxVAO;  // Empty; the sky triangle comes from gl_VertexID
+ShaderProgram skyboxShaderProgram;
 GLuint skyboxTexture;
 
 const int MAX_INSTANCES = gridSizeX * gridSizeZ;
@@ -73,17 +105,164 @@ std::vector<InstanceData> instanceData(MAX_INSTANCES);
 GLuint instanceVBO;
 
 
-std::vector<Car> cars;
+const int MAX_POOLED_CARS = 4096;
+const float RESIDENT_RADIUS = 30.0f;  // Streets closer than this to the camera carry cars
+CarPool carPool;
+TrafficScratch trafficScratch;
+std::vector<char> toppedUp;  // Resident streets streamCars() has given a car this tick
+int residentStreetFirst = 1, residentStreetLast = 0;  // Streets whose cars are in the pool
 const int NUM_CARS = 10;
-const float ROAD_LENGTH = 60.0f;  // Match  grid size * 2
 const float CAR_SPACING = 20.0f;  // Minimum space between cars
 GLuint carVAO, carVBO;
 
+// Car levels of detail, picked per car from its projected length on screen:
+// the full mesh with wheels, a single box, then a point sprite of its lights
+enum CarLod { CAR_LOD_FULL, CAR_LOD_BOX, CAR_LOD_POINT, CAR_LOD_COUNT };
+const float CAR_LENGTH = 1.2f;
+const float CAR_LOD_BOX_PIXELS = 48.0f;   // Shorter cars are drawn as boxes
+const float CAR_LOD_POINT_PIXELS = 8.0f;  // Shorter cars are drawn as points
+
+struct CarInstance {
+    glm::vec4 placement;   // position, yaw in radians
+    glm::vec4 appearance;  // color, flags: 1 moving forward, 2 braking
+    float pixels;          // Projected length, sizes the point sprites
+};
+
+std::vector<CarInstance> carLodInstances[CAR_LOD_COUNT];
+GLuint carLodVAO[CAR_LOD_COUNT], carLodInstanceVBO[CAR_LOD_COUNT];
+GLuint carBoxVBO;
+ShaderProgram carInstancedShaderProgram, carPointShaderProgram;
+
+// GPU traffic backend: car state lives in two buffers that a transform feedback
+// pass ping-pongs between every tick, and the instanced car draw reads it directly
+const int GPU_TRAFFIC_LANES = 1024;
+// As many cars as fit a lane without starting inside each other's braking
+// distance, which would jam every lane from the first tick
+const int MAX_GPU_CARS_PER_LANE = static_cast<int>(ROAD_LENGTH / BRAKING_DISTANCE);
+const int GPU_CARS_PER_LANE = MAX_GPU_CARS_PER_LANE;
+bool useGpuTraffic = false;
+int gpuTrafficLanes = GPU_TRAFFIC_LANES;
+int gpuCarsPerLane = GPU_CARS_PER_LANE;
+GLuint trafficStateVBO[2];   // vec4 per car: z, speed, lane, flags
+GLuint trafficStateTexture[2];  // Buffer textures over trafficStateVBO for leader lookups
+GLuint trafficUpdateVAO[2];
+GLuint trafficCarVAO[2];
+int trafficCurrent = 0;     // Index of the buffer holding the latest state
+ShaderProgram trafficUpdateShaderProgram;
+ShaderProgram carGpuShaderProgram;
+
+// Background traffic: cars on streets beyond the near radius are drawn from a
+// closed-form function of time in the vertex shader, with no CPU updates or uploads
+const float NEAR_TRAFFIC_RADIUS = 12.0f;  // Streets closer than this to the camera are simulated
+const int BACKGROUND_STREET_RADIUS = 16;  // Streets drawn either side of the camera
+float nearTrafficRadius = NEAR_TRAFFIC_RADIUS;
+bool useBackgroundTraffic = false;
+long trafficTick = 0;          // Number of updateCars() steps, the time base for analytic cars
+ShaderProgram carBackgroundShaderProgram;
+
+// Macroscopic traffic: beyond the near radius each street is a ring of cells holding
+// a car density, advanced with the cell transmission model instead of per-car updates
+const int MACRO_STREET_RADIUS = 64;          // Streets simulated either side of the camera
+const int MACRO_CELLS = 30;                  // Cells per street
+const float MACRO_CELL_LENGTH = ROAD_LENGTH / MACRO_CELLS;
+const float MACRO_FREE_FLOW_SPEED = 0.03f;   // Average cruising speed, units per tick
+const float MACRO_WAVE_SPEED = 0.01f;        // Speed congestion travels back along a street, units per tick
+const float MACRO_JAM_SPACING = 1.5f;        // Distance between stopped cars
+
+struct MacroStreet {
+    int street;                  // Street held in this slot of the ring
+    bool micro;                  // Cars are currently simulated individually by updateCars()
+    float residual;              // Fraction of a car left over when the street was last spawned
+    float density[MACRO_CELLS];  // Cars per cell, in travel order
+};
+
+bool useMacroTraffic = false;
+std::vector<MacroStreet> macroStreets(2 * MACRO_STREET_RADIUS + 1);
+std::vector<glm::vec4> macroInstances;        // Cars sampled from the density field, as for the GPU backend
+GLuint macroCarVAO, macroInstanceVBO;
+
+// Routing over the road graph: cars pick destinations among the resident
+// streets and turn at intersections to get there
+const int ROUTE_CACHE_SIZE = 16384;
+const int MAX_REROUTES_PER_TICK = 512;  // Cars still waiting keep driving straight on
+bool useRouting = false;
+RouteCache routeCache;
+int rerouteCursor = 0;
+
+// Features every lit program is built with, such as SHADER_FOG for --fog
+unsigned shaderFeatures = 0;
+
+// Vertex pulling: buildings, roads, cars and the player's ship are fetched from
+// one buffer of meshes and drawn by one uber program, with no vertex array or
+// program changes between them
+bool useVertexPulling = false;
+PulledGeometry pulledGeometry;
+MeshRange cubeMesh, roadMesh, carBodyMesh, carWheelMesh, carBoxMesh, xwingMesh;
+ShaderProgram uberShaderProgram;
+// The buildings as their persistent records were last written; a record is
+// rewritten only when its building moves, and only visible ones are drawn
+std::vector<InstanceData> pulledBuildings(MAX_INSTANCES, InstanceData{glm::vec3(0.0f), glm::vec3(0.0f)});
+
+// Cascaded sun shadows on the buildings, the road and the cars. The shadow map
+// stays bound to its own unit, which every program that samples it is told
+// about when it is linked or loaded.
+bool useShadows = false;
+const int SHADOW_MAP_SIZE = 1024;
+const GLenum SHADOW_MAP_UNIT = GL_TEXTURE6;  // Clear of unit 0 and the units of bindPulledDraws()
+const float SHADOW_SPLITS[SHADOW_CASCADES] = {8.0f, 20.0f, FAR_PLANE};
+ShadowCascades shadowCascades;
+ShaderProgram shadowBuildingProgram, shadowCarProgram;
+GLuint shadowBuildingVAO, shadowBuildingVBO;  // The cube, with the buildings in reach of one cascade
+GLuint shadowCarVAO, shadowCarVBO;            // The car mesh, with the cars in reach of the near cascade
+std::vector<InstanceData> shadowBuildings;
+std::vector<CarInstance> shadowCars;
+
+// Sun shadows marched through a texture of the building heights instead, with
+// no shadow map passes. Only buildings cast them.
+bool useHeightFieldShadows = false;
+const GLenum HEIGHT_FIELD_UNIT = GL_TEXTURE7;
+GLuint heightFieldTexture;
+bool heightFieldStale = true;  // A building changed since the last upload
+float tallestBuilding = 0.0f;
+
+// Car headlights and brake lights as clustered forward lights on the buildings
+// and the road: two spot lights ahead of every car on the CPU and a point light
+// behind each braking one, listed per cluster of the view every frame
+bool useCarLights = false;
+const int LIGHT_CLUSTER_TILES_X = 16;
+const int LIGHT_CLUSTER_TILES_Y = 9;
+const int LIGHT_CLUSTER_SLICES = 24;
+const GLenum LIGHT_DATA_UNIT = GL_TEXTURE8;
+const GLenum LIGHT_CLUSTER_UNIT = GL_TEXTURE9;
+const GLenum LIGHT_INDEX_UNIT = GL_TEXTURE10;
+const float HEADLIGHT_RANGE = 5.0f;
+const float HEADLIGHT_CONE = 0.85f;  // Cosine of the half angle
+const glm::vec3 HEADLIGHT_COLOR(1.0f, 0.9f, 0.7f);
+const float BRAKE_LIGHT_RANGE = 1.5f;
+const glm::vec3 BRAKE_LIGHT_COLOR(0.9f, 0.05f, 0.0f);
+LightClusters carLights;
+
+// Traffic lights at the intersections of the resident streets
+bool useSignals = false;
+TrafficSignals trafficSignals;
+std::vector<glm::vec4> signalInstances(MAX_SIGNALS);  // x, z, phase of every signal, as in signalInstanceVBO
+GLuint signalVAO, signalVBO, signalInstanceVBO;
+ShaderProgram signalShaderProgram;
+
+// Traffic recording and replay
+std::string recordPath;
+std::string replayPath;
+TrafficRecorder trafficRecorder;
+TrafficReplay trafficReplay;
+ReplayFrame replayFrame;  // Reused every tick
+
 // For FPS calculation
 double lastTime = 0.0;
 int frameCount = 0;
 double lastFPSUpdate = 0.0;
 double currentFPS = 0.0;
+int bindCalls = 0;    // GL binds made and elided since the last FPS update
+int bindsSkipped = 0;
 
 // Camera parameters
 float yaw = -90.0f; // Start looking forward (negative z)
@@ -95,74 +274,233 @@ const float mouseSensitivity = 0.01f;
 
 GLuint roadVAO, roadVBO; // Declare these globally for road rendering
 GLuint roadTexture;      // Declare the road texture globally
+ShaderProgram roadShaderProgram;  // Unless the road is pulled with everything else
+
+// Camera and light data shared by every program through the std140 FrameData
+// block of shaders/frame_data.glsl. The buffer holds FRAME_DATA_RING copies and
+// each frame writes the next one, so it never waits on a frame the GPU is
+// still drawing.
+struct FrameData
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 skyInverseViewProjection;  // Clip space to directions from the camera
+    glm::vec4 cameraPos;   // std140 gives each vec3 the room of a vec4
+    glm::vec4 lightPos;
+    glm::vec4 lightColor;
+    glm::mat4 shadowMatrices[SHADOW_CASCADES];  // World to the clip space of each shadow cascade
+    glm::vec4 shadowSplits;
+    glm::vec4 shadowTexelSizes;
+    glm::vec4 heightFieldLayout;  // x and z of the corner of cell (0, 0), cell size, tallest building
+    glm::vec4 clusterGrid;        // Light clusters across, down and deep
+    glm::vec4 clusterSlicing;     // Scale and bias from log view depth to a cluster slice
+};
+const GLuint FRAME_DATA_BINDING = 0;
+const int FRAME_DATA_RING = 3;
+GLuint frameDataUBO;
+GLintptr frameDataStride;  // sizeof(FrameData) rounded up to the offset alignment
+int frameDataSlot = 0;
+GLsync frameDataFence[FRAME_DATA_RING];
 
 
-// Utility function to read a shader file
-std::string readFile(const char *filePath)
+// Source of a shader embedded at build time, by its file name in shaders/
+std::string shaderSource(const char *name)
 {
-    std::ifstream file(filePath);
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    return buffer.str();
+    for (int i = 0; i < EMBEDDED_SHADER_COUNT; i++)
+    {
+        if (strcmp(EMBEDDED_SHADERS[i].name, name) == 0)
+            return EMBEDDED_SHADERS[i].source;
+    }
+    std::cerr << "ERROR::SHADER::NOT_EMBEDDED " << name << std::endl;
+    return "";
 }
 
-// Function to compile shaders
-GLuint compileShader(const char *vertexPath, const char *fragmentPath)
+// Insert the #defines of the features and the FrameData block after the
+// #version line of a shader. The #line directive keeps the line numbers of
+// compile errors matching the file.
+std::string withFrameData(const std::string &code, unsigned features)
 {
-    std::string vertexCode = readFile(vertexPath);
-    std::string fragmentCode = readFile(fragmentPath);
-
-    const char *vShaderCode = vertexCode.c_str();
-    const char *fShaderCode = fragmentCode.c_str();
+    static const std::string frameData = shaderSource("frame_data.glsl");
+    size_t versionEnd = code.find('\n');
+    if (versionEnd == std::string::npos)
+        return code;
 
-    GLuint vertex, fragment;
-    GLint success;
-    GLchar infoLog[512];
+    std::string defines;
+    for (const ShaderFeatureDefine &feature : SHADER_FEATURE_DEFINES)
+    {
+        if (features & feature.feature)
+            defines += std::string("#define ") + feature.define + "\n";
+    }
+    return code.substr(0, versionEnd + 1) + defines + frameData + "#line 2\n" + code.substr(versionEnd + 1);
+}
 
-    // Compile vertex shader
-    vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vShaderCode, NULL);
-    glCompileShader(vertex);
+// Block bindings and sampler units are not part of a binary, so they are set
+// on every program, loaded or linked. Programs that use none of the frame data
+// have the block optimised away, and only those built with SHADER_SHADOWS,
+// SHADER_HEIGHTFIELD_SHADOWS or SHADER_CAR_LIGHTS sample the shadow map, the
+// height field or the light clusters.
+void bindFrameData(GLuint shaderProgram)
+{
+    GLuint frameDataIndex = glGetUniformBlockIndex(shaderProgram, "FrameData");
+    if (frameDataIndex != GL_INVALID_INDEX)
+        glUniformBlockBinding(shaderProgram, frameDataIndex, FRAME_DATA_BINDING);
 
-    glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-    if (!success)
+    static const struct
     {
-        glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-        std::cerr << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
-                  << infoLog << std::endl;
+        const char *name;
+        GLenum unit;
+    } samplers[] = {{"shadowMap", SHADOW_MAP_UNIT},
+                    {"heightField", HEIGHT_FIELD_UNIT},
+                    {"lightData", LIGHT_DATA_UNIT},
+                    {"lightClusters", LIGHT_CLUSTER_UNIT},
+                    {"lightIndices", LIGHT_INDEX_UNIT}};
+    for (const auto &sampler : samplers)
+    {
+        GLint location = glGetUniformLocation(shaderProgram, sampler.name);
+        if (location != -1)
+        {
+            bindProgram(shaderProgram);
+            glUniform1i(location, sampler.unit - GL_TEXTURE0);
+        }
     }
+}
 
-    // Compile fragment shader
-    fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fShaderCode, NULL);
-    glCompileShader(fragment);
+// Flat-shaded stand-ins drawn while the real programs compile, one per vertex
+// shader and feature set, so they take the same attributes and uniforms
+const char *FALLBACK_FRAGMENT_SHADER = "fallback_fragment_shader.glsl";
+std::map<std::string, ShaderProgram> fallbackPrograms;
 
-    glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-    if (!success)
+ShaderProgram *fallbackProgram(const char *vertexName, unsigned features);
+
+// Function to compile shaders into a program, with its uniforms reflected. The
+// features pick the variant, as a mask of ShaderFeature. An unchanged program
+// is loaded from the program cache and ready at once; any other is compiled in
+// the background and draws with its fallback until pollShaderCompiler() has
+// finished it.
+void compileShader(ShaderProgram &program, const char *vertexName, const char *fragmentName, unsigned features = 0)
+{
+    ShaderSources sources;
+    sources.vertex = withFrameData(shaderSource(vertexName), features);
+    sources.fragment = withFrameData(shaderSource(fragmentName), features);
+    sources.varying = NULL;
+
+    program.id = 0;
+    program.ready = false;
+    program.fallback = NULL;
+
+    std::string cacheKey = programCacheKey(sources.vertex + '\0' + sources.fragment);
+    GLuint shaderProgram = loadCachedProgram(cacheKey);
+    if (shaderProgram != 0)
     {
-        glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-        std::cerr << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n"
-                  << infoLog << std::endl;
+        bindFrameData(shaderProgram);
+        reflectShaderProgram(program, shaderProgram);
+        return;
     }
 
-    // Link shaders into a program
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertex);
-    glAttachShader(shaderProgram, fragment);
-    glLinkProgram(shaderProgram);
+    if (strcmp(fragmentName, FALLBACK_FRAGMENT_SHADER) != 0)
+        program.fallback = fallbackProgram(vertexName, features);
+    compileProgramAsync(program, sources, cacheKey, bindFrameData);
+}
 
-    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-    if (!success)
+ShaderProgram *fallbackProgram(const char *vertexName, unsigned features)
+{
+    std::string name = std::string(vertexName) + "/" + std::to_string(features);
+    std::map<std::string, ShaderProgram>::iterator found = fallbackPrograms.find(name);
+    if (found != fallbackPrograms.end())
+        return &found->second;
+
+    // Queued ahead of the program it stands in for, so it is ready first
+    ShaderProgram &fallback = fallbackPrograms[name];
+    compileShader(fallback, vertexName, FALLBACK_FRAGMENT_SHADER, features);
+    return &fallback;
+}
+
+void setupFrameData()
+{
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    frameDataStride = (sizeof(FrameData) + alignment - 1) / alignment * alignment;
+
+    glGenBuffers(1, &frameDataUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameDataUBO);
+    glBufferData(GL_UNIFORM_BUFFER, FRAME_DATA_RING * frameDataStride, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    for (int i = 0; i < FRAME_DATA_RING; i++)
+        frameDataFence[i] = 0;
+}
+
+// Write this frame's camera and light data to the next copy in the ring and bind it
+void updateFrameData(const glm::mat4 &view, const glm::mat4 &projection)
+{
+    frameDataSlot = (frameDataSlot + 1) % FRAME_DATA_RING;
+    if (frameDataFence[frameDataSlot])
     {
-        glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-        std::cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
-                  << infoLog << std::endl;
+        // Only blocks when the GPU is FRAME_DATA_RING frames behind
+        glClientWaitSync(frameDataFence[frameDataSlot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        glDeleteSync(frameDataFence[frameDataSlot]);
+        frameDataFence[frameDataSlot] = 0;
     }
 
-    glDeleteShader(vertex);
-    glDeleteShader(fragment);
+    FrameData data;
+    data.view = view;
+    data.projection = projection;
+    data.skyInverseViewProjection = glm::inverse(projection * glm::mat4(glm::mat3(view)));
+    data.cameraPos = glm::vec4(cameraPos, 1.0f);
+    data.lightPos = glm::vec4(lightPos, 1.0f);
+    data.lightColor = glm::vec4(lightColor, 1.0f);
+    for (int i = 0; i < SHADOW_CASCADES; i++)
+    {
+        data.shadowMatrices[i] = shadowCascades.cascades[i].lightViewProjection;
+        data.shadowSplits[i] = useShadows ? shadowCascades.cascades[i].split : 0.0f;
+        data.shadowTexelSizes[i] = shadowCascades.cascades[i].texelSize;
+    }
+    data.shadowSplits.w = 0.0f;
+    data.shadowTexelSizes.w = 0.0f;
+    // Buildings stand in the middle of cells of two units, the first at -5
+    data.heightFieldLayout = glm::vec4(-6.0f, -6.0f, 2.0f, tallestBuilding);
+    data.clusterGrid = glm::vec4(LIGHT_CLUSTER_TILES_X, LIGHT_CLUSTER_TILES_Y, LIGHT_CLUSTER_SLICES, 0.0f);
+    data.clusterSlicing = glm::vec4(carLights.sliceScale, carLights.sliceBias, 0.0f, 0.0f);
+
+    GLintptr offset = frameDataSlot * frameDataStride;
+    glBindBuffer(GL_UNIFORM_BUFFER, frameDataUBO);
+    void *mapped = glMapBufferRange(GL_UNIFORM_BUFFER, offset, sizeof(FrameData),
+                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (mapped)
+    {
+        memcpy(mapped, &data, sizeof(FrameData));
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, frameDataUBO, offset, sizeof(FrameData));
+}
 
-    return shaderProgram;
+// Mark the end of the draws that read the current copy of the frame data
+void fenceFrameData()
+{
+    frameDataFence[frameDataSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// Function to compile a vertex-only program whose outputs are captured with
+// transform feedback. It has no fallback, so its users wait until it is ready.
+void compileTransformFeedbackShader(ShaderProgram &program, const char *vertexName, const char *varying)
+{
+    ShaderSources sources;
+    sources.vertex = shaderSource(vertexName);
+    sources.varying = varying;
+
+    program.id = 0;
+    program.ready = false;
+    program.fallback = NULL;
+
+    // The varyings are part of the link, so they are part of the key
+    std::string cacheKey = programCacheKey(sources.vertex + '\0' + varying);
+    GLuint cached = loadCachedProgram(cacheKey);
+    if (cached != 0)
+    {
+        reflectShaderProgram(program, cached);
+        return;
+    }
+    compileProgramAsync(program, sources, cacheKey, NULL);
 }
 
 // Cube vertices with normals
@@ -210,56 +548,6 @@ float cubeVertices[] = {
     -0.5f, 0.5f, 0.5f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f,
     -0.5f, 0.5f, -0.5f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f};
 
-float skyboxVertices[] = {
-    // positions
-    // Back face
-    -1.0f, -1.0f, -1.0f,
-    1.0f, -1.0f, -1.0f,
-    1.0f, 1.0f, -1.0f,
-    1.0f, 1.0f, -1.0f,
-    -1.0f, 1.0f, -1.0f,
-    -1.0f, -1.0f, -1.0f,
-
-    // Front face
-    -1.0f, -1.0f, 1.0f,
-    1.0f, -1.0f, 1.0f,
-    1.0f, 1.0f, 1.0f,
-    1.0f, 1.0f, 1.0f,
-    -1.0f, 1.0f, 1.0f,
-    -1.0f, -1.0f, 1.0f,
-
-    // Left face
-    -1.0f, 1.0f, 1.0f,
-    -1.0f, 1.0f, -1.0f,
-    -1.0f, -1.0f, -1.0f,
-    -1.0f, -1.0f, -1.0f,
-    -1.0f, -1.0f, 1.0f,
-    -1.0f, 1.0f, 1.0f,
-
-    // Right face
-    1.0f, 1.0f, 1.0f,
-    1.0f, 1.0f, -1.0f,
-    1.0f, -1.0f, -1.0f,
-    1.0f, -1.0f, -1.0f,
-    1.0f, -1.0f, 1.0f,
-    1.0f, 1.0f, 1.0f,
-
-    // Bottom face
-    -1.0f, -1.0f, -1.0f,
-    1.0f, -1.0f, -1.0f,
-    1.0f, -1.0f, 1.0f,
-    1.0f, -1.0f, 1.0f,
-    -1.0f, -1.0f, 1.0f,
-    -1.0f, -1.0f, -1.0f,
-
-    // Top face
-    -1.0f, 1.0f, -1.0f,
-    1.0f, 1.0f, -1.0f,
-    1.0f, 1.0f, 1.0f,
-    1.0f, 1.0f, 1.0f,
-    -1.0f, 1.0f, 1.0f,
-    -1.0f, 1.0f, -1.0f};
-
 // Load a texture from file
 GLuint loadTexture(const char *path)
 {
@@ -277,7 +565,7 @@ GLuint loadTexture(const char *path)
         std::cout << "Channels: " << nrChannels << std::endl;
 
         GLenum format = (nrChannels == 3) ? GL_RGB : GL_RGBA;
-        glBindTexture(GL_TEXTURE_2D, textureID);
+        bindTexture(GL_TEXTURE_2D, textureID);
         glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
         glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -297,46 +585,111 @@ GLuint loadTexture(const char *path)
 }
 
 
+// Point the mesh attributes at the bound buffer of positions, each followed by
+// its normal, as the car, X-wing and box meshes are laid out
+void setupMeshAttributes() {
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+}
+
+// The six planes of the frustum of a view projection matrix, facing inwards
+void frustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]) {
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++) {
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    }
+    for (int i = 0; i < 3; i++) {
+        planes[i * 2] = rows[3] + rows[i];
+        planes[i * 2 + 1] = rows[3] - rows[i];
+    }
+}
+
+// Whether a box may be inside the frustum: no plane has all of it behind
+bool boxInFrustum(const glm::vec4 planes[6], const glm::vec3& center, const glm::vec3& halfSize) {
+    for (int i = 0; i < 6; i++) {
+        glm::vec3 normal(planes[i]);
+        float reach = glm::dot(halfSize, glm::abs(normal));
+        if (glm::dot(normal, center) + planes[i].w < -reach) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Queue instances of a mesh in the pulled geometry, which the uber program
+// draws: the records listed from firstIndex of the instance store's index lists
+void queuePulledDraw(const MeshRange& mesh, GLenum mode, PulledMaterial material, int firstIndex, int instances,
+                     float depth) {
+    DrawPacket packet = drawPacket(uberShaderProgram, pulledGeometry.vertexArray, mode, mesh.first, mesh.count, instances);
+    packetUniform(renderQueue, packet, "firstIndex", firstIndex);
+    packetUniform(renderQueue, packet, "material", static_cast<int>(material));
+    pushDraw(renderQueue, RENDER_PASS_OPAQUE, depth, packet);
+}
+
+// Upload the frame's instances and bind what the uber program reads. Its
+// textures sit on units of their own, clear of the packets' unit 0.
+void bindPulledDraws(GLuint buildingTexture) {
+    uploadPulledInstances(pulledGeometry);
+    bindPulledGeometry(pulledGeometry, GL_TEXTURE1, GL_TEXTURE2, GL_TEXTURE5);
+    activeTextureUnit(GL_TEXTURE3);
+    bindTexture(GL_TEXTURE_2D, buildingTexture);
+    activeTextureUnit(GL_TEXTURE4);
+    bindTexture(GL_TEXTURE_2D, roadTexture);
+    activeTextureUnit(GL_TEXTURE0);
+
+    useShaderProgram(uberShaderProgram);
+    setUniform(uberShaderProgram, "meshData", 1);
+    setUniform(uberShaderProgram, "instanceData", 2);
+    setUniform(uberShaderProgram, "instanceIndices", 5);
+    setUniform(uberShaderProgram, "buildingTexture", 3);
+    setUniform(uberShaderProgram, "roadTexture", 4);
+}
+
 void setupXWing() {
     // Simple spaceship vertices - sleek, arrow-like design
     float shipVertices[] = {
+        // positions            // normals
         // Main body - triangular shape
         // Top face
-         0.0f,  0.1f, -0.6f,  // Front tip
-        -0.2f,  0.1f,  0.3f,  // Left back
-         0.2f,  0.1f,  0.3f,  // Right back
+         0.0f,  0.1f, -0.6f,   0.0f,  1.0f,  0.0f,  // Front tip
+        -0.2f,  0.1f,  0.3f,   0.0f,  1.0f,  0.0f,  // Left back
+         0.2f,  0.1f,  0.3f,   0.0f,  1.0f,  0.0f,  // Right back
 
         // Bottom face
-         0.0f, -0.1f, -0.6f,  // Front tip
-        -0.2f, -0.1f,  0.3f,  // Left back
-         0.2f, -0.1f,  0.3f,  // Right back
+         0.0f, -0.1f, -0.6f,   0.0f, -1.0f,  0.0f,  // Front tip
+        -0.2f, -0.1f,  0.3f,   0.0f, -1.0f,  0.0f,  // Left back
+         0.2f, -0.1f,  0.3f,   0.0f, -1.0f,  0.0f,  // Right back
 
         // Side wings
         // Left wing
-        -0.2f,  0.0f, -0.2f,  // Front
-        -0.4f,  0.0f,  0.1f,  // Back
-        -0.2f,  0.0f,  0.1f,  // Connect to body
+        -0.2f,  0.0f, -0.2f,   0.0f,  1.0f,  0.0f,  // Front
+        -0.4f,  0.0f,  0.1f,   0.0f,  1.0f,  0.0f,  // Back
+        -0.2f,  0.0f,  0.1f,   0.0f,  1.0f,  0.0f,  // Connect to body
 
         // Right wing
-         0.2f,  0.0f, -0.2f,  // Front
-         0.4f,  0.0f,  0.1f,  // Back
-         0.2f,  0.0f,  0.1f,  // Connect to body
+         0.2f,  0.0f, -0.2f,   0.0f,  1.0f,  0.0f,  // Front
+         0.4f,  0.0f,  0.1f,   0.0f,  1.0f,  0.0f,  // Back
+         0.2f,  0.0f,  0.1f,   0.0f,  1.0f,  0.0f,  // Connect to body
 
         // Rear stabilizer
-         0.0f,  0.2f,  0.0f,  // Top
-         0.0f,  0.0f,  0.3f,  // Back
-         0.0f, -0.1f,  0.0f   // Bottom
+         0.0f,  0.2f,  0.0f,   1.0f,  0.0f,  0.0f,  // Top
+         0.0f,  0.0f,  0.3f,   1.0f,  0.0f,  0.0f,  // Back
+         0.0f, -0.1f,  0.0f,   1.0f,  0.0f,  0.0f   // Bottom
     };
 
     glGenVertexArrays(1, &xwingVAO);
     glGenBuffers(1, &xwingVBO);
 
-    glBindVertexArray(xwingVAO);
+    bindVertexArray(xwingVAO);
     glBindBuffer(GL_ARRAY_BUFFER, xwingVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(shipVertices), shipVertices, GL_STATIC_DRAW);
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+    setupMeshAttributes();
+    if (useVertexPulling) {
+        xwingMesh = addPulledMesh(pulledGeometry, shipVertices, 15, 6, 3, -1);
+    }
 
     // Dark metallic color
     xwing.color = glm::vec3(0.3f, 0.3f, 0.35f);
@@ -351,11 +704,13 @@ void setupOpenGL(GLuint &VAO, GLuint &VBO)
     glGenBuffers(1, &VBO);
     glGenBuffers(1, &instanceVBO);
 
-    glBindVertexArray(VAO);
+    bindVertexArray(VAO);
 
     // Setup vertex buffer
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), cubeVertices, GL_STATIC_DRAW);
+    if (useVertexPulling)
+        cubeMesh = addPulledMesh(pulledGeometry, cubeVertices, 36, 8, 5, 3);
 
     // Position attribute
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)0);
@@ -384,7 +739,7 @@ void setupOpenGL(GLuint &VAO, GLuint &VBO)
     glVertexAttribDivisor(4, 1);
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    bindVertexArray(0);
 }
 
 
@@ -397,10 +752,7 @@ void updateXWing() {
     xwing.position = cameraPos + (cameraFront * distance) + glm::vec3(0.0f, -1.0f, 0.0f);  // -1.0f moves it down slightly
 }
 
-void renderXWing(GLuint shaderProgram, const glm::mat4& view, const glm::mat4& projection) {
-    glUseProgram(shaderProgram);
-    glBindVertexArray(xwingVAO);
-
+void renderXWing(ShaderProgram& shaderProgram) {
     glm::mat4 model = glm::mat4(1.0f);
     model = glm::translate(model, xwing.position);
     
@@ -414,228 +766,1015 @@ void renderXWing(GLuint shaderProgram, const glm::mat4& view, const glm::mat4& p
     // Scale
     model = glm::scale(model, glm::vec3(0.7f));
 
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    float depth = glm::length(xwing.position - cameraPos) / FAR_PLANE;
+    if (useVertexPulling) {
+        int first = instanceIndexCount(pulledGeometry.instances);
+        addInstanceIndex(pulledGeometry.instances, addPulledInstance(pulledGeometry, model, glm::vec4(xwing.color, 0.0f)));
+        queuePulledDraw(xwingMesh, GL_TRIANGLES, MATERIAL_CAR, first, 1, depth);
+        return;
+    }
 
-    // Main body
-    glUniform3fv(glGetUniformLocation(shaderProgram, "carColor"), 1, glm::value_ptr(xwing.color));
-    
-    // Draw main body triangles
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    
-    // Draw wings
-    glDrawArrays(GL_TRIANGLES, 6, 6);
-    
-    // Draw stabilizer
-    glDrawArrays(GL_TRIANGLES, 12, 3);
+    useShaderProgram(shaderProgram);
+    setUniform(shaderProgram, "carColor", xwing.color);
 
-    glBindVertexArray(0);
+    // Main body, wings and stabilizer in one draw
+    DrawPacket ship = drawPacket(shaderProgram, xwingVAO, GL_TRIANGLES, 0, 15);
+    packetUniform(renderQueue, ship, "model", model);
+    pushDraw(renderQueue, RENDER_PASS_OPAQUE, depth, ship);
 }
-void initializeCars() {
-    cars.clear();
-    
-    // Create cars for each street
-    for(int street = 0; street < NUM_STREETS; street++) {
-        float streetX = -30.0f + (street * STREET_SPACING);  // X position of this street
-        
-        // Add cars to this street
-        for(int i = 0; i < CARS_PER_STREET; i++) {
-            Car car;
-            // Distribute cars along the street length
-            float startZ = -ROAD_LENGTH/2 + (i * (ROAD_LENGTH/CARS_PER_STREET));
-            
-            car.position = glm::vec3(streetX, 0.3f, startZ);
-            car.speed = 0.02f + static_cast<float>(rand()) / RAND_MAX * 0.02f;  // Slower speed
-            // Alternate direction based on street number
-            car.movingForward = (street % 2 == 0);
-            
-            // Alternate colors for visual variety
-            if (street % 3 == 0) {
-                car.color = glm::vec3(0.8f, 0.2f, 0.2f);  // Red
-            } else if (street % 3 == 1) {
-                car.color = glm::vec3(0.2f, 0.2f, 0.8f);  // Blue
-            } else {
-                car.color = glm::vec3(0.8f, 0.8f, 0.8f);  // Silver
-            }
-            
-            cars.push_back(car);
+
+void setupFlyingTraffic() {
+    glGenVertexArrays(1, &flyerVAO);
+    glGenBuffers(1, &flyerInstanceVBO);
+
+    bindVertexArray(flyerVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, xwingVBO);
+    setupMeshAttributes();
+
+    glBindBuffer(GL_ARRAY_BUFFER, flyerInstanceVBO);
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+    glEnableVertexAttribArray(4);
+    glVertexAttribDivisor(4, 1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    bindVertexArray(0);
+
+    flyerInstances.reserve(flyerCount);
+}
+
+// Hand the flyers the building heights, which change as rows and columns wrap around the camera
+void updateFlyerHeightField() {
+    FlyerHeightField& field = flyingTraffic.heightField;
+    field.origin = glm::vec2(-5.0f, -5.0f);  // Initial building positions
+    field.cellSize = 2.0f;
+    field.width = gridSizeX;
+    field.depth = gridSizeZ;
+    field.heights.resize(gridSizeX * gridSizeZ);
+    for (int i = 0; i < gridSizeX; ++i) {
+        for (int j = 0; j < gridSizeZ; ++j) {
+            field.heights[i * gridSizeZ + j] = buildingHeights[i][j];
         }
     }
 }
 
+// Draw the flyers within sight in one instanced call
+void renderFlyingTraffic() {
+    flyerInstances.clear();
+    float reach2 = FLYER_DRAW_DISTANCE * FLYER_DRAW_DISTANCE;
+    for (const Flyer& flyer : flyingTraffic.flyers) {
+        glm::vec3 d = flyer.position - cameraPos;
+        if (glm::dot(d, d) < reach2) {
+            float heading = atan2(-flyer.velocity.x, -flyer.velocity.z);
+            flyerInstances.push_back(glm::vec4(flyer.position, heading));
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, flyerInstanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, flyerInstances.size() * sizeof(glm::vec4), flyerInstances.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    pushDraw(renderQueue, RENDER_PASS_OPAQUE, 0.0f,
+             drawPacket(flyerShaderProgram, flyerVAO, GL_TRIANGLES, 0, 15, static_cast<GLsizei>(flyerInstances.size())));
+}
+
+void initializeCars() {
+    initCarPool(carPool, MAX_POOLED_CARS);
+
+    // Streets are filled by streamCars() as they come within reach of the camera
+    residentStreetFirst = 1;
+    residentStreetLast = 0;
+}
+
+
+// Append the 36 vertices of a box centred on center, each with its face normal
+void addBox(std::vector<float>& vertices, glm::vec3 center, glm::vec3 half) {
+    static const float corners[36][3] = {
+        {-1,-1,-1}, { 1,-1,-1}, { 1, 1,-1},  {-1,-1,-1}, { 1, 1,-1}, {-1, 1,-1},  // Back
+        {-1,-1, 1}, { 1, 1, 1}, { 1,-1, 1},  {-1,-1, 1}, {-1, 1, 1}, { 1, 1, 1},  // Front
+        {-1,-1,-1}, {-1, 1, 1}, {-1,-1, 1},  {-1,-1,-1}, {-1, 1,-1}, {-1, 1, 1},  // Left
+        { 1,-1,-1}, { 1,-1, 1}, { 1, 1, 1},  { 1,-1,-1}, { 1, 1, 1}, { 1, 1,-1},  // Right
+        {-1, 1,-1}, { 1, 1, 1}, {-1, 1, 1},  {-1, 1,-1}, { 1, 1,-1}, { 1, 1, 1},  // Top
+        {-1,-1,-1}, {-1,-1, 1}, { 1,-1, 1},  {-1,-1,-1}, { 1,-1, 1}, { 1,-1,-1}   // Bottom
+    };
+    static const float normals[6][3] = {
+        {0, 0, -1}, {0, 0, 1}, {-1, 0, 0}, {1, 0, 0}, {0, 1, 0}, {0, -1, 0}
+    };
+    for (int i = 0; i < 36; i++) {
+        vertices.push_back(center.x + corners[i][0] * half.x);
+        vertices.push_back(center.y + corners[i][1] * half.y);
+        vertices.push_back(center.z + corners[i][2] * half.z);
+        vertices.insert(vertices.end(), normals[i / 6], normals[i / 6] + 3);
+    }
+}
 
 void setupCars() {
     // Car vertices (more realistic car shape)
     float carVertices[] = {
+        // positions            // normals
         // Main body - slightly curved top
         // Front face
-        -0.3f, -0.1f, -0.6f,  // Bottom left
-         0.3f, -0.1f, -0.6f,  // Bottom right
-         0.3f,  0.2f, -0.6f,  // Top right
-         0.3f,  0.2f, -0.6f,  // Top right
-        -0.3f,  0.2f, -0.6f,  // Top left
-        -0.3f, -0.1f, -0.6f,  // Bottom left
+        -0.3f, -0.1f, -0.6f,   0.0f,  0.0f, -1.0f,  // Bottom left
+         0.3f, -0.1f, -0.6f,   0.0f,  0.0f, -1.0f,  // Bottom right
+         0.3f,  0.2f, -0.6f,   0.0f,  0.0f, -1.0f,  // Top right
+         0.3f,  0.2f, -0.6f,   0.0f,  0.0f, -1.0f,  // Top right
+        -0.3f,  0.2f, -0.6f,   0.0f,  0.0f, -1.0f,  // Top left
+        -0.3f, -0.1f, -0.6f,   0.0f,  0.0f, -1.0f,  // Bottom left
 
         // Back face
-        -0.3f, -0.1f,  0.6f,
-         0.3f, -0.1f,  0.6f,
-         0.3f,  0.15f,  0.6f,  // Slightly lower for aerodynamic look
-         0.3f,  0.15f,  0.6f,
-        -0.3f,  0.15f,  0.6f,
-        -0.3f, -0.1f,  0.6f,
+        -0.3f, -0.1f,  0.6f,   0.0f,  0.0f,  1.0f,
+         0.3f, -0.1f,  0.6f,   0.0f,  0.0f,  1.0f,
+         0.3f,  0.15f,  0.6f,   0.0f,  0.0f,  1.0f,  // Slightly lower for aerodynamic look
+         0.3f,  0.15f,  0.6f,   0.0f,  0.0f,  1.0f,
+        -0.3f,  0.15f,  0.6f,   0.0f,  0.0f,  1.0f,
+        -0.3f, -0.1f,  0.6f,   0.0f,  0.0f,  1.0f,
 
         // Windshield (angled)
-        -0.25f,  0.2f, -0.2f,
-         0.25f,  0.2f, -0.2f,
-         0.25f,  0.25f, -0.4f,
-         0.25f,  0.25f, -0.4f,
-        -0.25f,  0.25f, -0.4f,
-        -0.25f,  0.2f, -0.2f,
+        -0.25f,  0.2f, -0.2f,   0.0f,  0.97f,  0.243f,
+         0.25f,  0.2f, -0.2f,   0.0f,  0.97f,  0.243f,
+         0.25f,  0.25f, -0.4f,   0.0f,  0.97f,  0.243f,
+         0.25f,  0.25f, -0.4f,   0.0f,  0.97f,  0.243f,
+        -0.25f,  0.25f, -0.4f,   0.0f,  0.97f,  0.243f,
+        -0.25f,  0.2f, -0.2f,   0.0f,  0.97f,  0.243f,
 
         // Hood
-        -0.25f,  0.15f, -0.6f,
-         0.25f,  0.15f, -0.6f,
-         0.25f,  0.15f, -0.4f,
-         0.25f,  0.15f, -0.4f,
-        -0.25f,  0.15f, -0.4f,
-        -0.25f,  0.15f, -0.6f,
+        -0.25f,  0.15f, -0.6f,   0.0f,  1.0f,  0.0f,
+         0.25f,  0.15f, -0.6f,   0.0f,  1.0f,  0.0f,
+         0.25f,  0.15f, -0.4f,   0.0f,  1.0f,  0.0f,
+         0.25f,  0.15f, -0.4f,   0.0f,  1.0f,  0.0f,
+        -0.25f,  0.15f, -0.4f,   0.0f,  1.0f,  0.0f,
+        -0.25f,  0.15f, -0.6f,   0.0f,  1.0f,  0.0f,
 
         // Roof
-        -0.25f,  0.25f, -0.4f,
-         0.25f,  0.25f, -0.4f,
-         0.25f,  0.25f,  0.1f,
-         0.25f,  0.25f,  0.1f,
-        -0.25f,  0.25f,  0.1f,
-        -0.25f,  0.25f, -0.4f,
+        -0.25f,  0.25f, -0.4f,   0.0f,  1.0f,  0.0f,
+         0.25f,  0.25f, -0.4f,   0.0f,  1.0f,  0.0f,
+         0.25f,  0.25f,  0.1f,   0.0f,  1.0f,  0.0f,
+         0.25f,  0.25f,  0.1f,   0.0f,  1.0f,  0.0f,
+        -0.25f,  0.25f,  0.1f,   0.0f,  1.0f,  0.0f,
+        -0.25f,  0.25f, -0.4f,   0.0f,  1.0f,  0.0f,
 
         // Left side
-        -0.3f,  0.2f,  0.6f,
-        -0.3f,  0.2f, -0.6f,
-        -0.3f, -0.1f, -0.6f,
-        -0.3f, -0.1f, -0.6f,
-        -0.3f, -0.1f,  0.6f,
-        -0.3f,  0.2f,  0.6f,
+        -0.3f,  0.2f,  0.6f,  -1.0f,  0.0f,  0.0f,
+        -0.3f,  0.2f, -0.6f,  -1.0f,  0.0f,  0.0f,
+        -0.3f, -0.1f, -0.6f,  -1.0f,  0.0f,  0.0f,
+        -0.3f, -0.1f, -0.6f,  -1.0f,  0.0f,  0.0f,
+        -0.3f, -0.1f,  0.6f,  -1.0f,  0.0f,  0.0f,
+        -0.3f,  0.2f,  0.6f,  -1.0f,  0.0f,  0.0f,
 
         // Right side
-         0.3f,  0.2f,  0.6f,
-         0.3f,  0.2f, -0.6f,
-         0.3f, -0.1f, -0.6f,
-         0.3f, -0.1f, -0.6f,
-         0.3f, -0.1f,  0.6f,
-         0.3f,  0.2f,  0.6f,
+         0.3f,  0.2f,  0.6f,   1.0f,  0.0f,  0.0f,
+         0.3f,  0.2f, -0.6f,   1.0f,  0.0f,  0.0f,
+         0.3f, -0.1f, -0.6f,   1.0f,  0.0f,  0.0f,
+         0.3f, -0.1f, -0.6f,   1.0f,  0.0f,  0.0f,
+         0.3f, -0.1f,  0.6f,   1.0f,  0.0f,  0.0f,
+         0.3f,  0.2f,  0.6f,   1.0f,  0.0f,  0.0f,
 
         // Bottom
-        -0.3f, -0.1f, -0.6f,
-         0.3f, -0.1f, -0.6f,
-         0.3f, -0.1f,  0.6f,
-         0.3f, -0.1f,  0.6f,
-        -0.3f, -0.1f,  0.6f,
-        -0.3f, -0.1f, -0.6f,
+        -0.3f, -0.1f, -0.6f,   0.0f, -1.0f,  0.0f,
+         0.3f, -0.1f, -0.6f,   0.0f, -1.0f,  0.0f,
+         0.3f, -0.1f,  0.6f,   0.0f, -1.0f,  0.0f,
+         0.3f, -0.1f,  0.6f,   0.0f, -1.0f,  0.0f,
+        -0.3f, -0.1f,  0.6f,   0.0f, -1.0f,  0.0f,
+        -0.3f, -0.1f, -0.6f,   0.0f, -1.0f,  0.0f,
 
         // Wheels (simplified as black boxes)
         // Front left wheel
-        -0.35f, -0.1f, -0.4f,
-        -0.35f,  0.0f, -0.4f,
-        -0.35f,  0.0f, -0.2f,
-        -0.35f, -0.1f, -0.2f,
+        -0.35f, -0.1f, -0.4f,  -1.0f,  0.0f,  0.0f,
+        -0.35f,  0.0f, -0.4f,  -1.0f,  0.0f,  0.0f,
+        -0.35f,  0.0f, -0.2f,  -1.0f,  0.0f,  0.0f,
+        -0.35f, -0.1f, -0.2f,  -1.0f,  0.0f,  0.0f,
 
         // Front right wheel
-         0.35f, -0.1f, -0.4f,
-         0.35f,  0.0f, -0.4f,
-         0.35f,  0.0f, -0.2f,
-         0.35f, -0.1f, -0.2f,
+         0.35f, -0.1f, -0.4f,   1.0f,  0.0f,  0.0f,
+         0.35f,  0.0f, -0.4f,   1.0f,  0.0f,  0.0f,
+         0.35f,  0.0f, -0.2f,   1.0f,  0.0f,  0.0f,
+         0.35f, -0.1f, -0.2f,   1.0f,  0.0f,  0.0f,
 
         // Back left wheel
-        -0.35f, -0.1f,  0.4f,
-        -0.35f,  0.0f,  0.4f,
-        -0.35f,  0.0f,  0.2f,
-        -0.35f, -0.1f,  0.2f,
+        -0.35f, -0.1f,  0.4f,  -1.0f,  0.0f,  0.0f,
+        -0.35f,  0.0f,  0.4f,  -1.0f,  0.0f,  0.0f,
+        -0.35f,  0.0f,  0.2f,  -1.0f,  0.0f,  0.0f,
+        -0.35f, -0.1f,  0.2f,  -1.0f,  0.0f,  0.0f,
 
         // Back right wheel
-         0.35f, -0.1f,  0.4f,
-         0.35f,  0.0f,  0.4f,
-         0.35f,  0.0f,  0.2f,
-         0.35f, -0.1f,  0.2f,
+         0.35f, -0.1f,  0.4f,   1.0f,  0.0f,  0.0f,
+         0.35f,  0.0f,  0.4f,   1.0f,  0.0f,  0.0f,
+         0.35f,  0.0f,  0.2f,   1.0f,  0.0f,  0.0f,
+         0.35f, -0.1f,  0.2f,   1.0f,  0.0f,  0.0f,
     };
 
     glGenVertexArrays(1, &carVAO);
     glGenBuffers(1, &carVBO);
 
-    glBindVertexArray(carVAO);
+    bindVertexArray(carVAO);
     glBindBuffer(GL_ARRAY_BUFFER, carVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(carVertices), carVertices, GL_STATIC_DRAW);
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+    setupMeshAttributes();
+    if (useVertexPulling) {
+        carBodyMesh = addPulledMesh(pulledGeometry, carVertices, 48, 6, 3, -1);
+        carWheelMesh = addPulledMesh(pulledGeometry, carVertices + 48 * 6, 16, 6, 3, -1);
+    }
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    bindVertexArray(0);
 }
 
 
 void updateCars() {
-    for(auto& car : cars) {
-        float moveAmount = car.movingForward ? car.speed : -car.speed;
-        car.position.z += moveAmount;
+    trafficTick++;
+    if (useSignals) {
+        updateTrafficSignals(trafficSignals, trafficTick);
+    }
+    updateTraffic(carPool, trafficScratch, trafficTick, useBackgroundTraffic, useSignals ? &trafficSignals : NULL);
+}
+
+
+// Point the instance attributes of a car LOD at its instance buffer
+void setupCarLodInstances(int lod) {
+    glBindBuffer(GL_ARRAY_BUFFER, carLodInstanceVBO[lod]);
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(CarInstance), (void*)offsetof(CarInstance, placement));
+    glEnableVertexAttribArray(4);
+    glVertexAttribDivisor(4, 1);
+    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(CarInstance), (void*)offsetof(CarInstance, appearance));
+    glEnableVertexAttribArray(5);
+    glVertexAttribDivisor(5, 1);
+    glVertexAttribPointer(6, 1, GL_FLOAT, GL_FALSE, sizeof(CarInstance), (void*)offsetof(CarInstance, pixels));
+    glEnableVertexAttribArray(6);
+    glVertexAttribDivisor(6, 1);
+}
+
+void setupCarLods() {
+    glGenVertexArrays(CAR_LOD_COUNT, carLodVAO);
+    glGenBuffers(CAR_LOD_COUNT, carLodInstanceVBO);
+    glGenBuffers(1, &carBoxVBO);
+
+    // Full detail: the mesh from setupCars()
+    bindVertexArray(carLodVAO[CAR_LOD_FULL]);
+    glBindBuffer(GL_ARRAY_BUFFER, carVBO);
+    setupMeshAttributes();
+    setupCarLodInstances(CAR_LOD_FULL);
+
+    // A box around the body
+    std::vector<float> boxVertices;
+    addBox(boxVertices, glm::vec3(0.0f, 0.05f, 0.0f), glm::vec3(0.3f, 0.15f, 0.6f));
+    bindVertexArray(carLodVAO[CAR_LOD_BOX]);
+    glBindBuffer(GL_ARRAY_BUFFER, carBoxVBO);
+    glBufferData(GL_ARRAY_BUFFER, boxVertices.size() * sizeof(float), boxVertices.data(), GL_STATIC_DRAW);
+    setupMeshAttributes();
+    if (useVertexPulling) {
+        carBoxMesh = addPulledMesh(pulledGeometry, boxVertices.data(), 36, 6, 3, -1);
+    }
+    setupCarLodInstances(CAR_LOD_BOX);
+
+    // Points need no mesh at all
+    bindVertexArray(carLodVAO[CAR_LOD_POINT]);
+    setupCarLodInstances(CAR_LOD_POINT);
 
-        // Wrap around when reaching the ends
-        if(car.position.z > ROAD_LENGTH/2) {
-            car.position.z = -ROAD_LENGTH/2;
-        } else if(car.position.z < -ROAD_LENGTH/2) {
-            car.position.z = ROAD_LENGTH/2;
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    bindVertexArray(0);
+
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    compileShader(carInstancedShaderProgram, "car_vertex_shader.glsl", "car_fragment_shader.glsl",
+                  SHADER_INSTANCING | shaderFeatures);
+    compileShader(carPointShaderProgram, "car_point_vertex_shader.glsl", "car_point_fragment_shader.glsl",
+                  shaderFeatures);
+}
+
+// Queue a car body and its wheels, in black, for count instances
+void queueCarDraws(ShaderProgram& program, GLuint vertexArray, GLsizei count) {
+    DrawPacket body = drawPacket(program, vertexArray, GL_TRIANGLES, 0, 48, count);
+    packetUniform(renderQueue, body, "wheels", 0);
+    pushDraw(renderQueue, RENDER_PASS_OPAQUE, 0.0f, body);
+
+    DrawPacket wheels = drawPacket(program, vertexArray, GL_TRIANGLE_FAN, 48, 16, count);
+    packetUniform(renderQueue, wheels, "wheels", 1);
+    pushDraw(renderQueue, RENDER_PASS_OPAQUE, 0.0f, wheels);
+}
+
+// Add cars as instances of the pulled geometry, with their headlights on, and
+// return the first index of their list
+int addPulledCars(const std::vector<CarInstance>& cars) {
+    int first = instanceIndexCount(pulledGeometry.instances);
+    for (const CarInstance& car : cars) {
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(car.placement));
+        model = glm::rotate(model, car.placement.w, glm::vec3(0.0f, 1.0f, 0.0f));
+        glm::vec4 appearance(glm::vec3(car.appearance), car.appearance.w + PULLED_HEADLIGHTS);
+        addInstanceIndex(pulledGeometry.instances, addPulledInstance(pulledGeometry, model, appearance));
+    }
+    return first;
+}
+
+// Sort the cars into LODs by projected length and queue each LOD as one
+// instanced draw (two for the full mesh, whose wheels are drawn in black)
+void renderCars(const glm::mat4& projection) {
+    // Pixels per world unit at distance 1
+    float pixelScale = projection[1][1] * windowHeight * 0.5f;
+    for (int lod = 0; lod < CAR_LOD_COUNT; lod++) {
+        carLodInstances[lod].clear();
+    }
+
+    for(int slot : carPool.active) {
+        const Car& car = carPool.slots[slot];
+
+        // Rotate car based on direction
+        float yaw = 0.0f;
+        if (car.cross >= 0) {
+            yaw = glm::radians(car.movingForward ? 90.0f : -90.0f);
+        } else if (!car.movingForward) {
+            yaw = glm::radians(180.0f);
         }
-        
-        // Check for nearby cars in same lane
-        for(const auto& otherCar : cars) {
-            if(&otherCar != &car && abs(car.position.x - otherCar.position.x) < 0.1f) { // Same lane
-                float distance = abs(car.position.z - otherCar.position.z);
-                if(distance < 2.0f) { // Too close
-                    car.speed *= 0.95f; // Slow down
-                    car.brakingLights = true;
-                } else {
-                    car.speed = 0.02f + static_cast<float>(rand()) / RAND_MAX * 0.02f; // Resume normal speed
-                    car.brakingLights = false;
+
+        CarInstance instance;
+        instance.placement = glm::vec4(car.position, yaw);
+        instance.appearance = glm::vec4(car.color, (car.movingForward ? 1.0f : 0.0f) + (car.brakingLights ? 2.0f : 0.0f));
+        instance.pixels = CAR_LENGTH * pixelScale / std::max(glm::length(car.position - cameraPos), 0.1f);
+
+        int lod = CAR_LOD_FULL;
+        if (instance.pixels < CAR_LOD_POINT_PIXELS) {
+            lod = CAR_LOD_POINT;
+        } else if (instance.pixels < CAR_LOD_BOX_PIXELS) {
+            lod = CAR_LOD_BOX;
+        }
+        carLodInstances[lod].push_back(instance);
+    }
+
+    for (int lod = 0; lod < CAR_LOD_COUNT; lod++) {
+        if (useVertexPulling && lod != CAR_LOD_POINT) {
+            continue;  // Meshes are pulled; only the points have an instance buffer
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, carLodInstanceVBO[lod]);
+        glBufferData(GL_ARRAY_BUFFER, carLodInstances[lod].size() * sizeof(CarInstance),
+                     carLodInstances[lod].data(), GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    GLsizei fullCount = static_cast<GLsizei>(carLodInstances[CAR_LOD_FULL].size());
+    GLsizei boxCount = static_cast<GLsizei>(carLodInstances[CAR_LOD_BOX].size());
+    GLsizei pointCount = static_cast<GLsizei>(carLodInstances[CAR_LOD_POINT].size());
+
+    if (useVertexPulling) {
+        int full = addPulledCars(carLodInstances[CAR_LOD_FULL]);
+        queuePulledDraw(carBodyMesh, GL_TRIANGLES, MATERIAL_CAR, full, fullCount, 0.0f);
+        queuePulledDraw(carWheelMesh, GL_TRIANGLE_FAN, MATERIAL_WHEEL, full, fullCount, 0.0f);
+        int box = addPulledCars(carLodInstances[CAR_LOD_BOX]);
+        queuePulledDraw(carBoxMesh, GL_TRIANGLES, MATERIAL_CAR, box, boxCount, 0.0f);
+    } else {
+        if (fullCount > 0) {
+            queueCarDraws(carInstancedShaderProgram, carLodVAO[CAR_LOD_FULL], fullCount);
+        }
+        if (boxCount > 0) {
+            DrawPacket box = drawPacket(carInstancedShaderProgram, carLodVAO[CAR_LOD_BOX], GL_TRIANGLES, 0, 36, boxCount);
+            packetUniform(renderQueue, box, "wheels", 0);
+            pushDraw(renderQueue, RENDER_PASS_OPAQUE, 0.0f, box);
+        }
+    }
+    if (pointCount > 0) {
+        pushDraw(renderQueue, RENDER_PASS_OPAQUE, 0.0f,
+                 drawPacket(carPointShaderProgram, carLodVAO[CAR_LOD_POINT], GL_POINTS, 0, 1, pointCount));
+    }
+}
+
+void setupPedestrians() {
+    // Legs, body and head
+    std::vector<float> figureVertices;
+    addBox(figureVertices, glm::vec3(0.0f, 0.08f, 0.0f), glm::vec3(0.03f, 0.08f, 0.02f));
+    addBox(figureVertices, glm::vec3(0.0f, 0.21f, 0.0f), glm::vec3(0.04f, 0.06f, 0.025f));
+    addBox(figureVertices, glm::vec3(0.0f, 0.31f, 0.0f), glm::vec3(0.025f, 0.025f, 0.025f));
+
+    glGenVertexArrays(1, &pedestrianVAO);
+    glGenBuffers(1, &pedestrianVBO);
+    glGenBuffers(1, &pedestrianInstanceVBO);
+
+    bindVertexArray(pedestrianVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, pedestrianVBO);
+    glBufferData(GL_ARRAY_BUFFER, figureVertices.size() * sizeof(float), figureVertices.data(), GL_STATIC_DRAW);
+    setupMeshAttributes();
+
+    glBindBuffer(GL_ARRAY_BUFFER, pedestrianInstanceVBO);
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+    glEnableVertexAttribArray(4);
+    glVertexAttribDivisor(4, 1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    bindVertexArray(0);
+
+    pedestrianInstances.reserve(pedestrianCount);
+}
+
+// Draw the pedestrians within sight in one instanced call, skipping whole
+// streets that are out of reach
+void renderPedestrians() {
+    pedestrianInstances.clear();
+    float reach2 = PEDESTRIAN_DRAW_DISTANCE * PEDESTRIAN_DRAW_DISTANCE;
+    for (int c = 0; c < CROWD_CHUNKS; c++) {
+        if (crowd.count[c] == 0 || fabs(streetX(crowd.street[c]) - cameraPos.x) > PEDESTRIAN_DRAW_DISTANCE + SIDEWALK_OUTER) {
+            continue;
+        }
+        int base = c * crowd.perChunk;
+        for (int i = base; i < base + crowd.count[c]; i++) {
+            glm::vec3 d = glm::vec3(crowd.x[i], 0.0f, crowd.z[i]) - cameraPos;
+            if (glm::dot(d, d) < reach2) {
+                float heading = atan2(-crowd.vx[i], -crowd.vz[i]);
+                pedestrianInstances.push_back(glm::vec4(crowd.x[i], crowd.z[i], heading, crowd.cruise[i]));
+            }
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, pedestrianInstanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, pedestrianInstances.size() * sizeof(glm::vec4), pedestrianInstances.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    pushDraw(renderQueue, RENDER_PASS_OPAQUE, 0.0f,
+             drawPacket(pedestrianShaderProgram, pedestrianVAO, GL_TRIANGLES, 0, 108,
+                        static_cast<GLsizei>(pedestrianInstances.size())));
+}
+
+// Draw every car on the streets around the camera that is not simulated on the CPU
+void renderBackgroundTraffic() {
+    useShaderProgram(carBackgroundShaderProgram);
+
+    int cameraStreet = static_cast<int>(floor((cameraPos.x + 30.0f) / STREET_SPACING + 0.5f));
+
+    setUniform(carBackgroundShaderProgram, "laneOriginX", -30.0f);
+    setUniform(carBackgroundShaderProgram, "laneSpacing", STREET_SPACING);
+    setUniform(carBackgroundShaderProgram, "roadLength", ROAD_LENGTH);
+    setUniform(carBackgroundShaderProgram, "carsPerStreet", CARS_PER_STREET);
+    setUniform(carBackgroundShaderProgram, "trafficTime", static_cast<float>(trafficTick));
+    setUniform(carBackgroundShaderProgram, "cameraStreet", cameraStreet);
+    setUniform(carBackgroundShaderProgram, "streetRadius", BACKGROUND_STREET_RADIUS);
+    setUniform(carBackgroundShaderProgram, "cameraX", cameraPos.x);
+    setUniform(carBackgroundShaderProgram, "nearRadius", nearTrafficRadius);
+
+    queueCarDraws(carBackgroundShaderProgram, carVAO, (2 * BACKGROUND_STREET_RADIUS + 1) * CARS_PER_STREET);
+}
+
+// Distance along a street from the end cars enter at, as used for the density cells
+float streetTravel(int street, float z) {
+    return (wrapIndex(street, 2) == 0) ? z + ROAD_LENGTH/2 : ROAD_LENGTH/2 - z;
+}
+
+float streetZ(int street, float travel) {
+    return (wrapIndex(street, 2) == 0) ? travel - ROAD_LENGTH/2 : ROAD_LENGTH/2 - travel;
+}
+
+// Cell transmission model parameters in cells per tick and cars per cell
+const float MACRO_VF = MACRO_FREE_FLOW_SPEED / MACRO_CELL_LENGTH;
+const float MACRO_W = MACRO_WAVE_SPEED / MACRO_CELL_LENGTH;
+const float MACRO_JAM_DENSITY = MACRO_CELL_LENGTH / MACRO_JAM_SPACING;
+const float MACRO_CRITICAL_DENSITY = MACRO_W * MACRO_JAM_DENSITY / (MACRO_VF + MACRO_W);
+const float MACRO_CAPACITY = MACRO_VF * MACRO_CRITICAL_DENSITY;
+
+// Speed of the cars in a cell from the triangular fundamental diagram, units per tick
+float macroCellSpeed(float density) {
+    if (density <= MACRO_CRITICAL_DENSITY) {
+        return MACRO_FREE_FLOW_SPEED;
+    }
+    return std::max(0.0f, MACRO_W * (MACRO_JAM_DENSITY - density) / density) * MACRO_CELL_LENGTH;
+}
+
+// Slot of the macroscopic ring holding a street, filled with a seeded density if it was not there yet
+MacroStreet& macroStreetFor(int street) {
+    MacroStreet& m = macroStreets[wrapIndex(street, static_cast<int>(macroStreets.size()))];
+    if (m.street != street) {
+        // Some streets are busier than others, so jams form on their own
+        unsigned int h = trafficHash(static_cast<unsigned int>(street + 0x100000));
+        float baseDensity = static_cast<float>(CARS_PER_STREET) / MACRO_CELLS;
+        float busyness = 0.25f + static_cast<float>(h & 0xffffu) / 65535.0f * 3.75f;
+        for (int i = 0; i < MACRO_CELLS; i++) {
+            float jitter = static_cast<float>(trafficHash(h + i) & 0xffffu) / 65535.0f;
+            m.density[i] = std::min(baseDensity * busyness * (0.5f + jitter), MACRO_JAM_DENSITY);
+        }
+        m.street = street;
+        m.micro = false;
+        m.residual = 0.0f;
+    }
+    return m;
+}
+
+// Replace a street's density field with individual cars, keeping the car count
+void spawnMacroStreet(int street) {
+    MacroStreet& m = macroStreetFor(street);
+    float total = m.residual;
+    for (int i = 0; i < MACRO_CELLS; i++) {
+        total += m.density[i];
+    }
+    float sampled = total - m.residual;
+    int count = sampled > 0.0f ? static_cast<int>(floor(total)) : 0;
+
+    // Place car k where the cumulative density reaches its quantile
+    float cumulative = 0.0f;
+    int k = 0;
+    for (int i = 0; i < MACRO_CELLS && k < count; i++) {
+        float d = m.density[i];
+        while (k < count && cumulative + d >= (k + 0.5f) * sampled / count) {
+            float travel = (i + ((k + 0.5f) * sampled / count - cumulative) / d) * MACRO_CELL_LENGTH;
+
+            Car* car = spawnCar(carPool);
+            if (!car) {
+                break;  // Pool exhausted, the rest stays in the residual
+            }
+            car->street = street;
+            car->position = glm::vec3(-30.0f + street * STREET_SPACING, 0.3f, streetZ(street, travel));
+            car->speed = macroCellSpeed(d);
+            car->movingForward = (wrapIndex(street, 2) == 0);
+            car->brakingLights = d > MACRO_CRITICAL_DENSITY;
+            car->headlightIntensity = 1.0f;
+            car->color = streetColor(street);
+            k++;
+        }
+        if (k < count && carPool.freeSlots.empty()) {
+            break;
+        }
+        cumulative += d;
+    }
+    for (int i = 0; i < MACRO_CELLS; i++) {
+        m.density[i] = 0.0f;
+    }
+    m.residual = total - k;
+    m.micro = true;
+}
+
+// Fold one car back into the density field of its street
+void absorbMacroCar(const Car& car) {
+    MacroStreet& m = macroStreetFor(car.street);
+    int cell = static_cast<int>(streetTravel(car.street, car.position.z) / MACRO_CELL_LENGTH);
+    m.density[std::min(std::max(cell, 0), MACRO_CELLS - 1)] += 1.0f;
+}
+
+// Fold a street's cars back into its density field
+void absorbMacroStreet(int street) {
+    for (int i = static_cast<int>(carPool.active.size()) - 1; i >= 0; i--) {
+        int slot = carPool.active[i];
+        if (carPool.slots[slot].street == street) {
+            absorbMacroCar(carPool.slots[slot]);
+            despawnCar(carPool, slot);
+        }
+    }
+    macroStreetFor(street).micro = false;
+}
+
+// One cell transmission model step around a street's ring of cells
+void stepMacroStreet(MacroStreet& m) {
+    float flow[MACRO_CELLS];
+    for (int i = 0; i < MACRO_CELLS; i++) {
+        float sending = std::min(MACRO_VF * m.density[i], MACRO_CAPACITY);
+        float receiving = std::min(MACRO_CAPACITY,
+                                   std::max(0.0f, MACRO_W * (MACRO_JAM_DENSITY - m.density[(i + 1) % MACRO_CELLS])));
+        flow[i] = std::min(sending, receiving);
+    }
+    for (int i = 0; i < MACRO_CELLS; i++) {
+        m.density[i] += flow[(i + MACRO_CELLS - 1) % MACRO_CELLS] - flow[i];
+    }
+}
+
+// Advance every street beyond the near radius as a density field
+void updateMacroTraffic() {
+    int cameraStreet = static_cast<int>(floor((cameraPos.x + 30.0f) / STREET_SPACING + 0.5f));
+    for (int street = cameraStreet - MACRO_STREET_RADIUS; street <= cameraStreet + MACRO_STREET_RADIUS; street++) {
+        MacroStreet& m = macroStreetFor(street);
+        if (!m.micro) {
+            stepMacroStreet(m);
+        }
+    }
+}
+
+// Sample car positions from the density field and draw them with the GPU traffic shader
+void renderMacroTraffic() {
+    macroInstances.clear();
+
+    int cameraStreet = static_cast<int>(floor((cameraPos.x + 30.0f) / STREET_SPACING + 0.5f));
+    for (int street = cameraStreet - MACRO_STREET_RADIUS; street <= cameraStreet + MACRO_STREET_RADIUS; street++) {
+        MacroStreet& m = macroStreetFor(street);
+        if (m.micro) {
+            continue;
+        }
+
+        float total = 0.0f;
+        for (int i = 0; i < MACRO_CELLS; i++) {
+            total += m.density[i];
+        }
+        int count = static_cast<int>(floor(total));
+        float forwardFlag = (wrapIndex(street, 2) == 0) ? 1.0f : 0.0f;
+
+        float cumulative = 0.0f;
+        int k = 0;
+        for (int i = 0; i < MACRO_CELLS && k < count; i++) {
+            float d = m.density[i];
+            float flags = forwardFlag + (d > MACRO_CRITICAL_DENSITY ? 2.0f : 0.0f);
+            while (k < count && cumulative + d >= (k + 0.5f) * total / count) {
+                float travel = (i + ((k + 0.5f) * total / count - cumulative) / d) * MACRO_CELL_LENGTH;
+                macroInstances.push_back(glm::vec4(streetZ(street, travel), macroCellSpeed(d), street, flags));
+                k++;
+            }
+            cumulative += d;
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, macroInstanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, macroInstances.size() * sizeof(glm::vec4), macroInstances.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    useShaderProgram(carGpuShaderProgram);
+    setUniform(carGpuShaderProgram, "laneOriginX", -30.0f);
+    setUniform(carGpuShaderProgram, "laneSpacing", STREET_SPACING);
+
+    queueCarDraws(carGpuShaderProgram, macroCarVAO, static_cast<GLsizei>(macroInstances.size()));
+}
+
+void setupMacroTraffic() {
+    for (auto& m : macroStreets) {
+        m.street = INT_MIN;
+    }
+
+    macroInstances.reserve(macroStreets.size() * MACRO_CELLS * 2);
+
+    glGenVertexArrays(1, &macroCarVAO);
+    glGenBuffers(1, &macroInstanceVBO);
+
+    bindVertexArray(macroCarVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, carVBO);
+    setupMeshAttributes();
+    glBindBuffer(GL_ARRAY_BUFFER, macroInstanceVBO);
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+    glEnableVertexAttribArray(4);
+    glVertexAttribDivisor(4, 1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    bindVertexArray(0);
+}
+
+void setupSignals() {
+    // Two lamps hang over each intersection, clear of the buildings: the one at
+    // +x shows the street's light, the one at -x the cross street's
+    std::vector<float> lampVertices;
+    addBox(lampVertices, glm::vec3(0.2f, 1.4f, 0.0f), glm::vec3(0.12f, 0.12f, 0.12f));
+    addBox(lampVertices, glm::vec3(-0.2f, 1.4f, 0.0f), glm::vec3(0.12f, 0.12f, 0.12f));
+
+    glGenVertexArrays(1, &signalVAO);
+    glGenBuffers(1, &signalVBO);
+    glGenBuffers(1, &signalInstanceVBO);
+
+    bindVertexArray(signalVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, signalVBO);
+    glBufferData(GL_ARRAY_BUFFER, lampVertices.size() * sizeof(float), lampVertices.data(), GL_STATIC_DRAW);
+    setupMeshAttributes();
+
+    // One instance per signal slot; unlit slots have phase 0 and are culled in the shader
+    glBindBuffer(GL_ARRAY_BUFFER, signalInstanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, MAX_SIGNALS * sizeof(glm::vec4), signalInstances.data(), GL_DYNAMIC_DRAW);
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+    glEnableVertexAttribArray(4);
+    glVertexAttribDivisor(4, 1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    bindVertexArray(0);
+}
+
+// Draw every traffic light in one instanced call. Only the span of signals
+// that changed since the last frame is uploaded.
+void renderSignals() {
+    if (!trafficSignals.changed.empty()) {
+        int low = MAX_SIGNALS, high = -1;
+        for (int index : trafficSignals.changed) {
+            int street = trafficSignals.street[index / NUM_CROSS_STREETS];
+            signalInstances[index] = glm::vec4(streetX(street), crossStreetZ(index % NUM_CROSS_STREETS),
+                                               static_cast<float>(trafficSignals.phase[index]), 0.0f);
+            low = std::min(low, index);
+            high = std::max(high, index);
+        }
+        clearSignalChanges(trafficSignals);
+
+        glBindBuffer(GL_ARRAY_BUFFER, signalInstanceVBO);
+        glBufferSubData(GL_ARRAY_BUFFER, low * sizeof(glm::vec4), (high - low + 1) * sizeof(glm::vec4), &signalInstances[low]);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    pushDraw(renderQueue, RENDER_PASS_OPAQUE, 0.0f,
+             drawPacket(signalShaderProgram, signalVAO, GL_TRIANGLES, 0, 72, MAX_SIGNALS));
+}
+
+// Put a cruising car on a street at z
+bool placeStreetCar(int street, float z) {
+    Car* car = spawnCar(carPool);
+    if (!car) {
+        return false;
+    }
+
+    float streetX = -30.0f + (street * STREET_SPACING);  // X position of this street
+    car->street = street;
+    car->position = glm::vec3(streetX, 0.3f, z);
+    if (useBackgroundTraffic) {
+        car->speed = backgroundStreetSpeed(street);
+    } else {
+        car->speed = randomCruiseSpeed(carPool.active.back(), trafficTick);  // Slower speed
+    }
+    // Alternate direction based on street number
+    car->movingForward = (wrapIndex(street, 2) == 0);
+    car->brakingLights = false;
+    car->headlightIntensity = 1.0f;
+    car->color = streetColor(street);
+    return true;
+}
+
+// Put the i-th of a street's CARS_PER_STREET cars on it
+bool spawnStreetCar(int street, int i) {
+    if (useBackgroundTraffic) {
+        // Pick the cars up exactly where the background shader was drawing them
+        return placeStreetCar(street, backgroundCarZ(street, i, trafficTick));
+    }
+    // Distribute cars along the street length
+    return placeStreetCar(street, -ROAD_LENGTH/2 + (i * (ROAD_LENGTH/CARS_PER_STREET)));
+}
+
+// Fill a street that just came within reach of the camera
+void spawnStreet(int street) {
+    if (useMacroTraffic) {
+        spawnMacroStreet(street);
+        return;
+    }
+
+    for (int i = 0; i < CARS_PER_STREET; i++) {
+        if (!spawnStreetCar(street, i)) {
+            return;
+        }
+    }
+}
+
+// Release the cars of a street that is now out of reach
+void despawnStreet(int street) {
+    if (useMacroTraffic) {
+        absorbMacroStreet(street);
+        return;
+    }
+
+    for (int i = static_cast<int>(carPool.active.size()) - 1; i >= 0; i--) {
+        int slot = carPool.active[i];
+        if (carPool.slots[slot].street == street) {
+            despawnCar(carPool, slot);
+        }
+    }
+}
+
+// Spawn and despawn cars as streets enter and leave the resident area around the camera
+void streamCars() {
+    // With a distant representation, only the near streets are simulated car by car
+    float radius = (useMacroTraffic || useBackgroundTraffic) ? nearTrafficRadius : RESIDENT_RADIUS;
+
+    int first = static_cast<int>(floor((cameraPos.x - radius + 30.0f) / STREET_SPACING));
+    int last = static_cast<int>(ceil((cameraPos.x + radius + 30.0f) / STREET_SPACING));
+    while (first <= last && fabs(-30.0f + first * STREET_SPACING - cameraPos.x) >= radius) first++;
+    while (last >= first && fabs(-30.0f + last * STREET_SPACING - cameraPos.x) >= radius) last--;
+
+    int previousFirst = residentStreetFirst, previousLast = residentStreetLast;
+    for (int street = residentStreetFirst; street <= residentStreetLast; street++) {
+        if (street < first || street > last) {
+            despawnStreet(street);
+            if (useSignals) {
+                removeStreetSignals(trafficSignals, street);
+            }
+        }
+    }
+    for (int street = first; street <= last; street++) {
+        if (street < residentStreetFirst || street > residentStreetLast) {
+            spawnStreet(street);
+            if (useSignals) {
+                addStreetSignals(trafficSignals, street, trafficTick);
+            }
+        }
+    }
+    residentStreetFirst = first;
+    residentStreetLast = last;
+
+    if (useRouting) {
+        // Routed cars can drive out of the resident streets on their own
+        for (int i = static_cast<int>(carPool.active.size()) - 1; i >= 0; i--) {
+            int slot = carPool.active[i];
+            const Car& car = carPool.slots[slot];
+            if (car.street < first || car.street > last) {
+                if (useMacroTraffic) {
+                    absorbMacroCar(car);
                 }
+                despawnCar(carPool, slot);
+            }
+        }
+
+        // Top the streets back up so the traffic does not thin out over time,
+        // one car per street per tick, in the middle of the street's widest
+        // gap. A gap has to keep the new car out of braking distance of the
+        // cars on both sides, or the street is left as it is. Streets filled
+        // just now are full and not grouped yet.
+        int wanted = (last - first + 1) * CARS_PER_STREET;
+        toppedUp.assign(last - first + 1, 0);
+        for (int street = first; street <= last; street++) {
+            toppedUp[street - first] = street < previousFirst || street > previousLast;
+        }
+        for (int n = static_cast<int>(carPool.active.size()); !useMacroTraffic && n < wanted; n++) {
+            unsigned int h = trafficHash(static_cast<unsigned int>(trafficTick * 31 + n));
+            int street = first + h % (last - first + 1);
+            float z;
+            if (toppedUp[street - first] ||
+                widestStreetGap(carPool, trafficScratch, street, z) < 2.0f * BRAKING_DISTANCE) {
+                continue;
+            }
+            toppedUp[street - first] = true;
+            if (!placeStreetCar(street, z)) {
+                break;
             }
         }
     }
 }
 
+// Give cars that reached the end of their route a new destination among the
+// resident streets. At most MAX_REROUTES_PER_TICK cars plan per tick, so a burst
+// of arrivals never stalls a frame; the rest drive straight on until their turn.
+void routeCars() {
+    int count = static_cast<int>(carPool.active.size());
+    if (count == 0 || residentStreetFirst > residentStreetLast) {
+        return;
+    }
 
-// Function to render cars
-void renderCars(GLuint shaderProgram, const glm::mat4& view, const glm::mat4& projection) {
-    glUseProgram(shaderProgram);
-    glBindVertexArray(carVAO);
+    int planned = 0, scanned = 0;
+    for (; scanned < count && planned < MAX_REROUTES_PER_TICK; scanned++) {
+        int slot = carPool.active[(rerouteCursor + scanned) % count];
+        Route& route = carPool.routes[slot];
+        if (route.next < route.count) {
+            continue;
+        }
 
-    for(const auto& car : cars) {
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, car.position);
-        
-        // Rotate car based on direction
-        if (!car.movingForward) {
-            model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        // Plan from the next intersection ahead, which the car reaches whatever happens
+        const Car& car = carPool.slots[slot];
+        RoadNode from;
+        if (car.cross < 0) {
+            float along = (car.position.z + ROAD_LENGTH/2) / CROSS_SPACING;
+            from.street = car.street;
+            from.cross = static_cast<int>(car.movingForward ? ceil(along) : floor(along));
+        } else {
+            float along = (car.position.x + 30.0f) / STREET_SPACING;
+            from.street = static_cast<int>(car.movingForward ? ceil(along) : floor(along));
+            from.cross = car.cross;
         }
+        unsigned int h = trafficHash(static_cast<unsigned int>(slot) * 7919u + static_cast<unsigned int>(trafficTick));
+        RoadNode to;
+        to.street = residentStreetFirst + static_cast<int>(h % (residentStreetLast - residentStreetFirst + 1));
+        to.cross = static_cast<int>((h >> 16) % NUM_CROSS_STREETS);
+        planRoute(routeCache, from, car.cross < 0, to, route);
+        planned++;
+    }
+    rerouteCursor = (rerouteCursor + scanned) % count;
+}
 
-        // Set uniforms
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniform3fv(glGetUniformLocation(shaderProgram, "carColor"), 1, glm::value_ptr(car.color));
-        glUniform1i(glGetUniformLocation(shaderProgram, "brakingLights"), car.brakingLights);
-        glUniform1f(glGetUniformLocation(shaderProgram, "headlightIntensity"), car.headlightIntensity);
-        glUniform1i(glGetUniformLocation(shaderProgram, "movingForward"), car.movingForward);
+// Snapshot the camera and every pooled car for the recorder
+void captureReplayFrame(ReplayFrame& frame) {
+    frame.tick = trafficTick;
+    frame.cameraPos = cameraPos;
+    frame.cameraFront = cameraFront;
+    frame.yaw = yaw;
+    frame.pitch = pitch;
+    frame.cars.resize(carPool.active.size());
+    for (size_t i = 0; i < carPool.active.size(); i++) {
+        const Car& car = carPool.slots[carPool.active[i]];
+        ReplayCar& recorded = frame.cars[i];
+        recorded.slot = carPool.active[i];
+        recorded.street = car.street;
+        recorded.z = car.position.z;
+        recorded.x = car.position.x;
+        recorded.onCross = car.cross >= 0;
+        recorded.movingForward = car.movingForward;
+        recorded.brakingLights = car.brakingLights;
+    }
+}
 
-        // Draw main car body
-        glDrawArrays(GL_TRIANGLES, 0, 48);  // Draw main body vertices
+// Put the camera and the pooled cars where the recording had them. Only the
+// active list is rebuilt; nothing spawns during replay so the free list is left alone.
+void applyReplayFrame(const ReplayFrame& frame) {
+    trafficTick = frame.tick;
+    cameraPos = frame.cameraPos;
+    yaw = frame.yaw;
+    pitch = frame.pitch;
+    cameraFront = frame.cameraFront;
+
+    for (int slot : carPool.active) {
+        carPool.activeIndex[slot] = -1;
+    }
+    carPool.active.clear();
+    for (const ReplayCar& recorded : frame.cars) {
+        if (recorded.slot >= static_cast<int>(carPool.slots.size()) || carPool.activeIndex[recorded.slot] != -1) {
+            continue;
+        }
+        Car& car = carPool.slots[recorded.slot];
+        car.street = recorded.street;
+        car.position = glm::vec3(recorded.onCross ? recorded.x : -30.0f + recorded.street * STREET_SPACING,
+                                 0.3f, recorded.z);
+        car.cross = recorded.onCross ? wrapIndex(static_cast<int>(floor((recorded.z + ROAD_LENGTH/2) / CROSS_SPACING + 0.5f)),
+                                                 NUM_CROSS_STREETS) : -1;
+        car.speed = 0.0f;
+        car.color = streetColor(recorded.street);
+        car.movingForward = recorded.movingForward;
+        car.brakingLights = recorded.brakingLights;
+        car.headlightIntensity = 1.0f;
+        carPool.activeIndex[recorded.slot] = static_cast<int>(carPool.active.size());
+        carPool.active.push_back(recorded.slot);
+    }
+    carPool.revision++;
+}
+
+// The cruising speed traffic_update_vertex_shader.glsl gives a car, by its slot
+float gpuCruiseSpeed(int id) {
+    return 0.02f + static_cast<float>(trafficHash(static_cast<unsigned int>(id)) & 0xffffu) / 65535.0f * 0.02f;
+}
+
+void setupGpuTraffic() {
+    int carCount = gpuTrafficLanes * gpuCarsPerLane;
+    std::vector<glm::vec4> state(carCount);
+
+    // Store cars lane by lane, evenly spaced in travel order, so that the car
+    // ahead of slot i is always slot i + 1 (wrapping within the lane)
+    for (int lane = 0; lane < gpuTrafficLanes; lane++) {
+        bool forward = (lane % 2 == 0);
+        for (int i = 0; i < gpuCarsPerLane; i++) {
+            float travel = i * (ROAD_LENGTH / gpuCarsPerLane);
+            float z = forward ? travel - ROAD_LENGTH/2 : ROAD_LENGTH/2 - travel;
+            int id = lane * gpuCarsPerLane + i;
+            state[id] = glm::vec4(z, gpuCruiseSpeed(id), lane, forward ? 1.0f : 0.0f);
+        }
+    }
 
-        // Draw wheels in black
-        glm::vec3 wheelColor(0.1f, 0.1f, 0.1f);
-        glUniform3fv(glGetUniformLocation(shaderProgram, "carColor"), 1, glm::value_ptr(wheelColor));
-        glDrawArrays(GL_TRIANGLE_FAN, 48, 16);  // Draw wheel vertices
+    glGenBuffers(2, trafficStateVBO);
+    glGenTextures(2, trafficStateTexture);
+    glGenVertexArrays(2, trafficUpdateVAO);
+    glGenVertexArrays(2, trafficCarVAO);
+
+    for (int i = 0; i < 2; i++) {
+        glBindBuffer(GL_ARRAY_BUFFER, trafficStateVBO[i]);
+        glBufferData(GL_ARRAY_BUFFER, carCount * sizeof(glm::vec4), state.data(), GL_DYNAMIC_COPY);
+
+        bindTexture(GL_TEXTURE_BUFFER, trafficStateTexture[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, trafficStateVBO[i]);
+
+        // Update pass reads one state per point
+        bindVertexArray(trafficUpdateVAO[i]);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+        glEnableVertexAttribArray(0);
+
+        // Render pass uses the car mesh with one state per instance
+        bindVertexArray(trafficCarVAO[i]);
+        glBindBuffer(GL_ARRAY_BUFFER, carVBO);
+        setupMeshAttributes();
+        glBindBuffer(GL_ARRAY_BUFFER, trafficStateVBO[i]);
+        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+        glEnableVertexAttribArray(4);
+        glVertexAttribDivisor(4, 1);
     }
 
-    glBindVertexArray(0);
+    bindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    bindTexture(GL_TEXTURE_BUFFER, 0);
+
+    compileTransformFeedbackShader(trafficUpdateShaderProgram, "traffic_update_vertex_shader.glsl", "outState");
+    trafficCurrent = 0;
+}
+
+// Advance every car by one tick on the GPU, writing into the other buffer
+void updateGpuTraffic() {
+    if (!trafficUpdateShaderProgram.ready) {
+        return;  // Cars wait where they are until the program has compiled
+    }
+    int next = 1 - trafficCurrent;
+
+    useShaderProgram(trafficUpdateShaderProgram);
+    setUniform(trafficUpdateShaderProgram, "carsPerLane", gpuCarsPerLane);
+    setUniform(trafficUpdateShaderProgram, "roadLength", ROAD_LENGTH);
+    setUniform(trafficUpdateShaderProgram, "trafficState", 0);
+
+    activeTextureUnit(GL_TEXTURE0);
+    bindTexture(GL_TEXTURE_BUFFER, trafficStateTexture[trafficCurrent]);
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    bindVertexArray(trafficUpdateVAO[trafficCurrent]);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, trafficStateVBO[next]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, gpuTrafficLanes * gpuCarsPerLane);
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+
+    trafficCurrent = next;
+}
+
+void renderGpuTraffic() {
+    useShaderProgram(carGpuShaderProgram);
+    setUniform(carGpuShaderProgram, "laneOriginX", -30.0f);
+    setUniform(carGpuShaderProgram, "laneSpacing", STREET_SPACING);
+
+    queueCarDraws(carGpuShaderProgram, trafficCarVAO[trafficCurrent], gpuTrafficLanes * gpuCarsPerLane);
+}
+
+void cleanupGpuTraffic() {
+    glDeleteVertexArrays(2, trafficUpdateVAO);
+    glDeleteVertexArrays(2, trafficCarVAO);
+    glDeleteTextures(2, trafficStateTexture);
+    glDeleteBuffers(2, trafficStateVBO);
+    deleteShaderProgram(trafficUpdateShaderProgram);
 }
 
 void updateFPS(GLFWwindow *window)
@@ -643,17 +1782,26 @@ void updateFPS(GLFWwindow *window)
     // Get current time
     double currentTime = glfwGetTime();
     frameCount++;
+    GlStateCounters binds = takeGlStateCounters();
+    bindCalls += binds.calls;
+    bindsSkipped += binds.skipped;
 
     // Update FPS every 0.5 seconds
     if (currentTime - lastFPSUpdate >= 0.5)
     {
         // Calculate FPS
         currentFPS = double(frameCount) / (currentTime - lastFPSUpdate);
+        int callsPerFrame = bindCalls / frameCount;
+        int skippedPerFrame = bindsSkipped / frameCount;
         frameCount = 0;
+        bindCalls = 0;
+        bindsSkipped = 0;
         lastFPSUpdate = currentTime;
 
-        // Update window title with FPS
-        std::string title = "CyberDublin | FPS: " + std::to_string(static_cast<int>(currentFPS));
+        // Update window title with FPS and the binds per frame
+        std::string title = "CyberDublin | FPS: " + std::to_string(static_cast<int>(currentFPS)) +
+                            " | Binds: " + std::to_string(callsPerFrame) +
+                            " (" + std::to_string(skippedPerFrame) + " skipped)";
         glfwSetWindowTitle(window, title.c_str());
     }
 }
@@ -681,13 +1829,37 @@ void setupRoad() {
         roadVertices.insert(roadVertices.end(), std::begin(streetVerts), std::end(streetVerts));
     }
 
+    // Cross streets join the streets at the intersections of the road graph
+    float xStart = -30.0f - 0.5f;
+    float xEnd = -30.0f + (NUM_STREETS - 1) * STREET_SPACING + 0.5f;
+    float repeats = (xEnd - xStart) / 2.0f;
+    for (int c = 0; c < NUM_CROSS_STREETS; c++) {
+        float zPos = crossStreetZ(c);
+
+        float crossVerts[] = {
+            // Positions          // Texture Coords
+            xStart, 0.001f, zPos + 0.5f,  0.0f, 0.0f,
+            xStart, 0.001f, zPos - 0.5f,  1.0f, 0.0f,
+            xEnd,   0.001f, zPos - 0.5f,  1.0f, repeats,
+
+            xStart, 0.001f, zPos + 0.5f,  0.0f, 0.0f,
+            xEnd,   0.001f, zPos - 0.5f,  1.0f, repeats,
+            xEnd,   0.001f, zPos + 0.5f,  0.0f, repeats
+        };
+
+        roadVertices.insert(roadVertices.end(), std::begin(crossVerts), std::end(crossVerts));
+    }
+
     // Create and bind VAO and VBO for roads
     glGenVertexArrays(1, &roadVAO);
     glGenBuffers(1, &roadVBO);
 
-    glBindVertexArray(roadVAO);
+    bindVertexArray(roadVAO);
     glBindBuffer(GL_ARRAY_BUFFER, roadVBO);
     glBufferData(GL_ARRAY_BUFFER, roadVertices.size() * sizeof(float), roadVertices.data(), GL_STATIC_DRAW);
+    if (useVertexPulling) {
+        roadMesh = addPulledMesh(pulledGeometry, roadVertices.data(), static_cast<int>(roadVertices.size() / 5), 5, -1, 3);
+    }
 
     // Position attribute
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
@@ -700,44 +1872,37 @@ void setupRoad() {
     // Load road texture
     roadTexture = loadTexture("../assets/road.jpg");
 
-    glBindVertexArray(0);
+    bindVertexArray(0);
 }
 
 
-void renderRoad(GLuint shaderProgram, const glm::mat4& view, const glm::mat4& projection) {
-    glUseProgram(shaderProgram);
-
-    // Set transformation matrices
-    glm::mat4 model = glm::mat4(1.0f);
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-
-    // Bind road texture
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, roadTexture);
-    glUniform1i(glGetUniformLocation(shaderProgram, "roadTexture"), 0);
+void renderRoad() {
+    // Keep the streets centred on the camera, snapped to whole streets
+    float roadShift = STREET_SPACING * floor(cameraPos.x / STREET_SPACING + 0.5f);
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(roadShift, 0.0f, 0.0f));
+    if (useVertexPulling) {
+        int first = instanceIndexCount(pulledGeometry.instances);
+        addInstanceIndex(pulledGeometry.instances, addPulledInstance(pulledGeometry, model, glm::vec4(0.0f)));
+        queuePulledDraw(roadMesh, GL_TRIANGLES, MATERIAL_ROAD, first, 1, 0.0f);
+        return;
+    }
 
-    // Render the road
-    glBindVertexArray(roadVAO);
-    glDrawArrays(GL_TRIANGLES, 0, NUM_STREETS * 6);
-    glBindVertexArray(0);
+    useShaderProgram(roadShaderProgram);
+    setUniform(roadShaderProgram, "roadTexture", 0);
+    DrawPacket road = drawPacket(roadShaderProgram, roadVAO, GL_TRIANGLES, 0, (NUM_STREETS + NUM_CROSS_STREETS) * 6);
+    packetTexture(road, GL_TEXTURE_2D, roadTexture);
+    packetUniform(renderQueue, road, "model", model);
+    pushDraw(renderQueue, RENDER_PASS_OPAQUE, 0.0f, road);
 }
 
 void setupSkybox()
 {
-    // Generate and bind VAO and VBO for skybox
+    // The sky needs no vertices, but a core context cannot draw without a VAO
     glGenVertexArrays(1, &skyboxVAO);
-    glGenBuffers(1, &skyboxVBO);
-    glBindVertexArray(skyboxVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
 
     // Load skybox shader
-    skyboxShaderProgram = compileShader("../shaders/skybox_vertex_shader.glsl",
-                                        "../shaders/skybox_fragment_shader.glsl");
+    compileShader(skyboxShaderProgram, "skybox_vertex_shader.glsl",
+                  "skybox_fragment_shader.glsl");
 
     // Change the path to match the building texture path format
     skyboxTexture = loadTexture("../assets/sky.jpg"); // Changed from "./assets/sky.jpg"
@@ -748,7 +1913,7 @@ void setupSkybox()
         // Create a default blue texture as fallback
         unsigned char defaultColor[] = {100, 149, 237, 255}; // Cornflower blue
         glGenTextures(1, &skyboxTexture);
-        glBindTexture(GL_TEXTURE_2D, skyboxTexture);
+        bindTexture(GL_TEXTURE_2D, skyboxTexture);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, defaultColor);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -756,31 +1921,173 @@ void setupSkybox()
 }
 
 
-void renderSkybox(const glm::mat4 &view, const glm::mat4 &projection)
+void renderSkybox()
 {
-    glDepthFunc(GL_LEQUAL);
-    glUseProgram(skyboxShaderProgram);
+    // Set the texture uniform
+    useShaderProgram(skyboxShaderProgram);
+    setUniform(skyboxShaderProgram, "skyboxTexture", 0);
+
+    // One triangle over the whole screen at the far plane, queued in the sky
+    // pass after everything opaque, so early depth testing skips every pixel
+    // that something was drawn on
+    DrawPacket sky = drawPacket(skyboxShaderProgram, skyboxVAO, GL_TRIANGLES, 0, 3);
+    packetTexture(sky, GL_TEXTURE_2D, skyboxTexture);
+    pushDraw(renderQueue, RENDER_PASS_SKY, 1.0f, sky);
+}
 
-    // Remove translation from view matrix
-    glm::mat4 skyboxView = glm::mat4(glm::mat3(view));
+// Shadow casters take only the positions of the building cube and the car mesh
+void setupShadows(GLuint cubeVBO) {
+    createShadowCascades(shadowCascades, SHADOW_MAP_SIZE, SHADOW_SPLITS, lightPos);
+    activeTextureUnit(SHADOW_MAP_UNIT);
+    bindTexture(GL_TEXTURE_2D_ARRAY, shadowCascades.depthTexture);
+    activeTextureUnit(GL_TEXTURE0);
+
+    glGenVertexArrays(1, &shadowBuildingVAO);
+    glGenBuffers(1, &shadowBuildingVBO);
+    bindVertexArray(shadowBuildingVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, shadowBuildingVBO);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offsetof(InstanceData, position));
+    glEnableVertexAttribArray(3);
+    glVertexAttribDivisor(3, 1);
+    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offsetof(InstanceData, scale));
+    glEnableVertexAttribArray(4);
+    glVertexAttribDivisor(4, 1);
 
-    // Set uniforms
-    glUniformMatrix4fv(glGetUniformLocation(skyboxShaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(skyboxView));
-    glUniformMatrix4fv(glGetUniformLocation(skyboxShaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    glGenVertexArrays(1, &shadowCarVAO);
+    glGenBuffers(1, &shadowCarVBO);
+    bindVertexArray(shadowCarVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, carVBO);
+    setupMeshAttributes();
+    glBindBuffer(GL_ARRAY_BUFFER, shadowCarVBO);
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(CarInstance), (void*)offsetof(CarInstance, placement));
+    glEnableVertexAttribArray(4);
+    glVertexAttribDivisor(4, 1);
 
-    // Set the texture uniform
-    glUniform1i(glGetUniformLocation(skyboxShaderProgram, "skyboxTexture"), 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    bindVertexArray(0);
 
-    // Bind skybox texture
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, skyboxTexture);
+    compileShader(shadowBuildingProgram, "shadow_building_vertex_shader.glsl", "shadow_fragment_shader.glsl");
+    compileShader(shadowCarProgram, "shadow_car_vertex_shader.glsl", "shadow_fragment_shader.glsl");
+}
 
-    // Render skybox quad
-    glBindVertexArray(skyboxVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 36); // Updated vertex count
-    glBindVertexArray(0);
+// Draw the cascades that need it. Each takes only the casters in its reach,
+// so its cost depends on the cascade and not on the size of the city, and
+// only the near one, with the cars, is drawn every frame.
+void renderShadows(int buildingCount) {
+    if (!drawableProgram(shadowBuildingProgram)) {
+        return;  // The cascades stay marked until there is something to draw them with
+    }
+    bool drawn = false;
+    for (int c = 0; c < SHADOW_CASCADES; c++) {
+        const ShadowCascade& cascade = shadowCascades.cascades[c];
+        if (!cascade.dirty) {
+            continue;
+        }
+        shadowBuildings.clear();
+        for (int i = 0; i < buildingCount; i++) {
+            if (boxInShadowCascade(shadowCascades, c, instanceData[i].position, instanceData[i].scale * 0.5f)) {
+                shadowBuildings.push_back(instanceData[i]);
+            }
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, shadowBuildingVBO);
+        glBufferData(GL_ARRAY_BUFFER, shadowBuildings.size() * sizeof(InstanceData), shadowBuildings.data(),
+                     GL_STREAM_DRAW);
+
+        beginShadowCascade(shadowCascades, c);
+        drawn = true;
+        useShaderProgram(shadowBuildingProgram);
+        setUniform(shadowBuildingProgram, "lightViewProjection", cascade.lightViewProjection);
+        bindVertexArray(shadowBuildingVAO);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 36, static_cast<GLsizei>(shadowBuildings.size()));
+
+        // Cars only shade the near cascade; further out they are a texel or two
+        if (c == 0 && !useGpuTraffic && drawableProgram(shadowCarProgram)) {
+            shadowCars.clear();
+            for (int lod = CAR_LOD_FULL; lod <= CAR_LOD_BOX; lod++) {
+                for (const CarInstance& car : carLodInstances[lod]) {
+                    if (boxInShadowCascade(shadowCascades, 0, glm::vec3(car.placement), glm::vec3(CAR_LENGTH * 0.5f))) {
+                        shadowCars.push_back(car);
+                    }
+                }
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, shadowCarVBO);
+            glBufferData(GL_ARRAY_BUFFER, shadowCars.size() * sizeof(CarInstance), shadowCars.data(), GL_STREAM_DRAW);
+            useShaderProgram(shadowCarProgram);
+            setUniform(shadowCarProgram, "lightViewProjection", cascade.lightViewProjection);
+            bindVertexArray(shadowCarVAO);
+            glDrawArraysInstanced(GL_TRIANGLES, 0, 48, static_cast<GLsizei>(shadowCars.size()));  // The body
+        }
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    if (drawn) {
+        endShadowCascades(windowWidth, windowHeight);
+    }
+}
 
-    glDepthFunc(GL_LESS);
+void setupHeightField() {
+    glGenTextures(1, &heightFieldTexture);
+    activeTextureUnit(HEIGHT_FIELD_UNIT);
+    bindTexture(GL_TEXTURE_2D, heightFieldTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, gridSizeZ, gridSizeX, 0, GL_RED, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    activeTextureUnit(GL_TEXTURE0);
+}
+
+// Send the building heights as they are laid out, a row of texels per column
+// of buildings, when one has changed. The texture stays bound to its unit.
+void uploadHeightField() {
+    if (!heightFieldStale) {
+        return;
+    }
+    activeTextureUnit(HEIGHT_FIELD_UNIT);
+    bindTexture(GL_TEXTURE_2D, heightFieldTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, gridSizeZ, gridSizeX, GL_RED, GL_FLOAT, buildingHeights);
+    activeTextureUnit(GL_TEXTURE0);
+
+    tallestBuilding = 0.0f;
+    for (int i = 0; i < gridSizeX; i++) {
+        for (int j = 0; j < gridSizeZ; j++) {
+            tallestBuilding = std::max(tallestBuilding, buildingHeights[i][j]);
+        }
+    }
+    heightFieldStale = false;
+}
+
+void setupCarLights() {
+    createLightClusters(carLights, LIGHT_CLUSTER_TILES_X, LIGHT_CLUSTER_TILES_Y, LIGHT_CLUSTER_SLICES, 0.1f,
+                        FAR_PLANE);
+}
+
+// Light every car renderCars() placed, whatever its LOD, and list the lights
+// in the clusters of this frame's view. The textures stay bound to their units.
+void renderCarLights(const glm::mat4& view, const glm::mat4& projection) {
+    clearClusterLights(carLights);
+    for (int lod = 0; lod < CAR_LOD_COUNT; lod++) {
+        for (const CarInstance& car : carLodInstances[lod]) {
+            // The mesh faces -z before its yaw
+            float c = cos(car.placement.w);
+            float s = sin(car.placement.w);
+            glm::vec3 forward(-s, 0.0f, -c);
+            glm::vec3 right(c, 0.0f, -s);
+            glm::vec3 position(car.placement);
+            glm::vec3 beam = glm::normalize(forward + glm::vec3(0.0f, -0.2f, 0.0f));
+            for (int side = -1; side <= 1; side += 2) {
+                glm::vec3 lamp = position + forward * (CAR_LENGTH * 0.5f) + right * (0.15f * side);
+                addClusterLight(carLights, lamp, HEADLIGHT_RANGE, HEADLIGHT_COLOR, beam, HEADLIGHT_CONE);
+            }
+            if (static_cast<int>(car.appearance.w) & 2) {
+                addClusterLight(carLights, position - forward * (CAR_LENGTH * 0.5f), BRAKE_LIGHT_RANGE,
+                                BRAKE_LIGHT_COLOR, forward, -1.0f);
+            }
+        }
+    }
+    assignLightClusters(carLights, view, projection);
+    uploadLightClusters(carLights);
+    bindLightClusters(carLights, LIGHT_DATA_UNIT, LIGHT_CLUSTER_UNIT, LIGHT_INDEX_UNIT);
 }
 
 void mouse_callback(GLFWwindow *window, double xposIn, double yposIn)
@@ -828,7 +2135,7 @@ void framebuffer_size_callback(GLFWwindow *window, int width, int height)
     glViewport(0, 0, windowWidth, windowHeight);
 
     float aspectRatio = static_cast<float>(windowWidth) / static_cast<float>(windowHeight);
-    projection = glm::perspective(glm::radians(60.0f), aspectRatio, 0.1f, 50.0f);
+    projection = glm::perspective(glm::radians(60.0f), aspectRatio, 0.1f, FAR_PLANE);
 }
 
 void processInput(GLFWwindow *window)
@@ -859,8 +2166,140 @@ void processInput(GLFWwindow *window)
         glfwSetWindowShouldClose(window, true);
 }
 
-int main()
+// Parse command line options
+void parseArguments(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--gpu-traffic")
+        {
+            // Optional lane and cars-per-lane counts, e.g. --gpu-traffic 4096 30
+            useGpuTraffic = true;
+            if (i + 2 < argc && isdigit(argv[i + 1][0]) && isdigit(argv[i + 2][0]))
+            {
+                gpuTrafficLanes = std::max(1, atoi(argv[++i]));
+                gpuCarsPerLane = std::min(std::max(1, atoi(argv[++i])), MAX_GPU_CARS_PER_LANE);
+            }
+        }
+        else if (arg == "--background-traffic")
+        {
+            useBackgroundTraffic = true;
+        }
+        else if (arg == "--macro-traffic")
+        {
+            useMacroTraffic = true;
+        }
+        else if (arg == "--near-radius" && i + 1 < argc)
+        {
+            nearTrafficRadius = static_cast<float>(atof(argv[++i]));
+        }
+        else if (arg == "--routing")
+        {
+            useRouting = true;
+        }
+        else if (arg == "--flying-traffic")
+        {
+            // Optional number of flyers, e.g. --flying-traffic 20000
+            useFlyingTraffic = true;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                flyerCount = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--pedestrians")
+        {
+            // Optional number of pedestrians, e.g. --pedestrians 200000
+            usePedestrians = true;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                pedestrianCount = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--signals")
+        {
+            useSignals = true;
+        }
+        else if (arg == "--vertex-pulling")
+        {
+            useVertexPulling = true;
+        }
+        else if (arg == "--fog")
+        {
+            shaderFeatures |= SHADER_FOG;
+        }
+        else if (arg == "--shadows")
+        {
+            useShadows = true;
+            shaderFeatures |= SHADER_SHADOWS;
+        }
+        else if (arg == "--heightfield-shadows")
+        {
+            useHeightFieldShadows = true;
+            shaderFeatures |= SHADER_HEIGHTFIELD_SHADOWS;
+        }
+        else if (arg == "--car-lights")
+        {
+            useCarLights = true;
+            shaderFeatures |= SHADER_CAR_LIGHTS;
+        }
+        else if (arg == "--record" && i + 1 < argc)
+        {
+            recordPath = argv[++i];
+        }
+        else if (arg == "--replay" && i + 1 < argc)
+        {
+            replayPath = argv[++i];
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << arg << std::endl;
+        }
+    }
+}
+
+int main(int argc, char **argv)
 {
+    parseArguments(argc, argv);
+
+    // A replay brings its own seed and traffic settings
+    ReplayHeader replayHeader;
+    replayHeader.seed = static_cast<unsigned>(time(0));
+    replayHeader.backgroundTraffic = false;
+    replayHeader.nearRadius = nearTrafficRadius;
+    bool replaying = !replayPath.empty();
+    if (replaying)
+    {
+        if (!openReplay(trafficReplay, replayPath, replayHeader))
+            return -1;
+        useBackgroundTraffic = replayHeader.backgroundTraffic;
+        nearTrafficRadius = replayHeader.nearRadius;
+        if (useGpuTraffic || useMacroTraffic || useSignals || !recordPath.empty())
+            std::cerr << "Replay only drives the recorded cars; ignoring --gpu-traffic, --macro-traffic, --signals and --record" << std::endl;
+        useGpuTraffic = false;
+        useMacroTraffic = false;
+        useSignals = false;
+        recordPath.clear();
+    }
+    if (useRouting)
+    {
+        initRoadGraph();
+        initRouteCache(routeCache, ROUTE_CACHE_SIZE);
+    }
+    if (useGpuTraffic && !recordPath.empty())
+    {
+        std::cerr << "GPU traffic cannot be recorded; ignoring --record" << std::endl;
+        recordPath.clear();
+    }
+    if (useShadows && useHeightFieldShadows)
+    {
+        std::cerr << "Only one shadow technique at a time; ignoring --shadows" << std::endl;
+        useShadows = false;
+        shaderFeatures &= ~SHADER_SHADOWS;
+    }
+    if (useCarLights && useGpuTraffic)
+    {
+        std::cerr << "GPU traffic has no car positions on the CPU to light; ignoring --car-lights" << std::endl;
+        useCarLights = false;
+        shaderFeatures &= ~SHADER_CAR_LIGHTS;
+    }
+
     // Initialize GLFW
     if (!glfwInit())
     {
@@ -899,38 +2338,107 @@ int main()
     // Enable depth testing
     glEnable(GL_DEPTH_TEST);
 
+    setupFrameData();
+    startShaderCompiler(window);
+
     // Compile shaders
-    GLuint shaderProgram = compileShader("../shaders/vertex_shader.glsl", "../shaders/fragment_shader.glsl");
+    ShaderProgram shaderProgram;
+    compileShader(shaderProgram, "vertex_shader.glsl", "fragment_shader.glsl", shaderFeatures);
     roadTexture = loadTexture("../assets/road.jpg");
-    GLuint carShaderProgram = compileShader("../shaders/car_vertex_shader.glsl", 
-                                          "../shaders/car_fragment_shader.glsl");
+    ShaderProgram carShaderProgram;
+    compileShader(carShaderProgram, "car_vertex_shader.glsl", "car_fragment_shader.glsl", shaderFeatures);
+    if (!useVertexPulling)
+        compileShader(roadShaderProgram, "road_vertex_shader.glsl", "road_fragement_shader.glsl", shaderFeatures);
 
     setupRoad();
     setupCars();
+    setupCarLods();
     setupXWing();
+    if (useFlyingTraffic)
+    {
+        setupFlyingTraffic();
+        compileShader(flyerShaderProgram, "flyer_vertex_shader.glsl",
+                      "car_fragment_shader.glsl", shaderFeatures);
+    }
+    if (usePedestrians)
+    {
+        setupPedestrians();
+        compileShader(pedestrianShaderProgram, "pedestrian_vertex_shader.glsl",
+                      "car_fragment_shader.glsl", shaderFeatures);
+    }
 
     initializeCars();
-
+    if (useGpuTraffic)
+    {
+        setupGpuTraffic();
+        useBackgroundTraffic = false;  // The GPU backend already covers every lane
+        useMacroTraffic = false;
+        useSignals = false;            // GPU cars do not stop at lights
+    }
+    if (useMacroTraffic)
+    {
+        setupMacroTraffic();
+        useBackgroundTraffic = false;  // Distant streets come from the density field instead
+    }
+    if (useGpuTraffic || useMacroTraffic)
+    {
+        compileShader(carGpuShaderProgram, "car_gpu_vertex_shader.glsl",
+                      "car_fragment_shader.glsl", shaderFeatures);
+    }
+    if (useSignals)
+    {
+        initTrafficSignals(trafficSignals, trafficTick);
+        setupSignals();
+        compileShader(signalShaderProgram, "signal_vertex_shader.glsl",
+                      "signal_fragment_shader.glsl");
+    }
+    if (useBackgroundTraffic)
+    {
+        compileShader(carBackgroundShaderProgram, "car_background_vertex_shader.glsl",
+                      "car_fragment_shader.glsl", shaderFeatures);
+    }
 
 
     // Set up buffers
     GLuint VAO, VBO;
     setupOpenGL(VAO, VBO);
     setupSkybox();
+    if (useShadows)
+        setupShadows(VBO);
+    if (useHeightFieldShadows)
+        setupHeightField();
+    if (useCarLights)
+        setupCarLights();
+    if (useVertexPulling)
+    {
+        uploadPulledMeshes(pulledGeometry, MAX_INSTANCES);
+        compileShader(uberShaderProgram, "uber_vertex_shader.glsl", "uber_fragment_shader.glsl", shaderFeatures);
+    }
+
+    ProgramCacheStats cacheStats = programCacheStats();
+    std::cout << "Shader programs: " << cacheStats.hits << " loaded from " << PROGRAM_CACHE_DIR << ", "
+              << cacheStats.misses << " compiled" << std::endl;
 
     // Load texture
     GLuint texture1 = loadTexture("../assets/building.jpg");
 
     // Set the initial projection matrix
     float aspectRatio = static_cast<float>(windowWidth) / static_cast<float>(windowHeight);
-    projection = glm::perspective(glm::radians(60.0f), aspectRatio, 0.1f, 50.0f);
+    projection = glm::perspective(glm::radians(60.0f), aspectRatio, 0.1f, FAR_PLANE);
 
     glm::mat4 view = glm::lookAt(cameraPos,
                                  glm::vec3(0.0f, 0.0f, 0.0f),  // Look at center
                                  glm::vec3(0.0f, 1.0f, 0.0f)); // Up vector
 
     // Seed the random number generator and initialize building heights
-    srand(static_cast<unsigned>(time(0)));
+    srand(replayHeader.seed);
+    trafficSeed = replayHeader.seed;
+    bool recording = false;
+    if (!recordPath.empty())
+    {
+        replayHeader.backgroundTraffic = useBackgroundTraffic;
+        recording = openRecording(trafficRecorder, recordPath, replayHeader);
+    }
     for (int i = 0; i < gridSizeX; ++i)
     {
         for (int j = 0; j < gridSizeZ; ++j)
@@ -952,34 +2460,78 @@ int main()
         zOffset[j] = -5.0f + j * 2.0f; // Initial positions
     }
 
+    if (useFlyingTraffic || usePedestrians)
+    {
+        // Spread the flyers, the pedestrians and the car updates over every core
+        startWorkers(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    if (useFlyingTraffic)
+        initFlyingTraffic(flyingTraffic, flyerCount, cameraPos, trafficSeed);
+    if (usePedestrians)
+        initCrowd(crowd, pedestrianCount);
+
+    auto replayStart = std::chrono::steady_clock::now();
+
     // Render loop
     while (!glfwWindowShouldClose(window))
     {
-        processInput(window);
+        pollShaderCompiler();
+
+        if (replaying)
+        {
+            if (!readReplayFrame(trafficReplay, replayFrame))
+                break;
+            applyReplayFrame(replayFrame);
+            if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+                glfwSetWindowShouldClose(window, true);
+        }
+        else
+        {
+            processInput(window);
+        }
         // Clear the screen
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         // Update view matrix with the new camera position
         view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+        if (useShadows)
+            updateShadowCascades(shadowCascades, cameraPos);
+        if (useHeightFieldShadows)
+            uploadHeightField();  // Buildings only change far beyond the far plane, so a frame late is soon enough
+        updateFrameData(view, projection);
         updateXWing();
+        if (useFlyingTraffic)
+        {
+            updateFlyerHeightField();
+            updateFlyingTraffic(flyingTraffic, cameraPos);
+        }
+        if (usePedestrians)
+        {
+            streamCrowd(crowd, cameraPos.x);
+            updateCrowd(crowd);
+        }
         
-        updateCars();
-
-        renderSkybox(view, projection);
-        // Use shader program
-        glUseProgram(shaderProgram);
-
-        renderRoad(shaderProgram, view, projection);
-
-        // Pass transformation matrices to the shader
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightPos"), 1, glm::value_ptr(lightPos));
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightColor"), 1, glm::value_ptr(lightColor));
+        if (useGpuTraffic)
+        {
+            updateGpuTraffic();
+        }
+        else if (!replaying)
+        {
+            streamCars();
+            if (useRouting)
+                routeCars();
+            if (useMacroTraffic)
+                updateMacroTraffic();
+            updateCars();
+            if (recording)
+            {
+                captureReplayFrame(replayFrame);
+                recordFrame(trafficRecorder, replayFrame);
+            }
+        }
 
-        // Bind the texture
-        glBindTexture(GL_TEXTURE_2D, texture1);
-        glBindVertexArray(VAO);
+        renderSkybox();
+        renderRoad();
 
         int instanceCount = 0;
 
@@ -1025,44 +2577,151 @@ int main()
                                                        (static_cast<float>(RAND_MAX / (8.0f - 2.0f)));
                 }
 
-                // Model transformation
-                glm::mat4 model = glm::translate(glm::mat4(1.0f),
-                                                 glm::vec3(baseX, buildingHeights[i][j] / 2.0f, baseZ));
-                model = glm::scale(model, glm::vec3(1.0f, buildingHeights[i][j], 1.0f));
-
-                glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-                glDrawArrays(GL_TRIANGLES, 0, 36);
-
                 // Update instance data
-                instanceData[instanceCount].position = glm::vec3(baseX, buildingHeights[i][j] / 2.0f, baseZ);
-                instanceData[instanceCount].scale = glm::vec3(1.0f, buildingHeights[i][j], 1.0f);
+                InstanceData &building = instanceData[instanceCount];
+                glm::vec3 position(baseX, buildingHeights[i][j] / 2.0f, baseZ);
+                glm::vec3 scale(1.0f, buildingHeights[i][j], 1.0f);
+                if (position != building.position || scale != building.scale)
+                {
+                    // Cached cascades show the building where it was, not where it is
+                    if (useShadows)
+                    {
+                        invalidateShadowCasters(shadowCascades, building.position, building.scale * 0.5f);
+                        invalidateShadowCasters(shadowCascades, position, scale * 0.5f);
+                    }
+                    heightFieldStale = true;
+                }
+                building.position = position;
+                building.scale = scale;
                 instanceCount++;
             }
         }
 
-        // Update instance buffer
-        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, instanceCount * sizeof(InstanceData), &instanceData[0]);
-        glDrawArraysInstanced(GL_TRIANGLES, 0, 36, instanceCount);
-
-        renderCars(carShaderProgram, view, projection);
-        renderXWing(carShaderProgram, view, projection);
+        if (useVertexPulling)
+        {
+            glm::vec4 planes[6];
+            frustumPlanes(projection * view, planes);
+            int firstBuilding = instanceIndexCount(pulledGeometry.instances);
+            for (int i = 0; i < instanceCount; i++)
+            {
+                const InstanceData& building = instanceData[i];
+                if (building.position != pulledBuildings[i].position || building.scale != pulledBuildings[i].scale)
+                {
+                    glm::mat4 model = glm::translate(glm::mat4(1.0f), building.position);
+                    setPulledInstance(pulledGeometry, i, glm::scale(model, building.scale), glm::vec4(0.0f));
+                    pulledBuildings[i] = building;
+                }
+                // The cube mesh spans -0.5 to 0.5
+                if (boxInFrustum(planes, building.position, building.scale * 0.5f))
+                    addInstanceIndex(pulledGeometry.instances, i);
+            }
+            queuePulledDraw(cubeMesh, GL_TRIANGLES, MATERIAL_BUILDING, firstBuilding,
+                            instanceIndexCount(pulledGeometry.instances) - firstBuilding, 0.0f);
+        }
+        else
+        {
+            // Update instance buffer
+            glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, instanceCount * sizeof(InstanceData), &instanceData[0]);
+            DrawPacket buildings = drawPacket(shaderProgram, VAO, GL_TRIANGLES, 0, 36, instanceCount);
+            packetTexture(buildings, GL_TEXTURE_2D, texture1);
+            pushDraw(renderQueue, RENDER_PASS_OPAQUE, 0.0f, buildings);
+        }
 
+        if (useGpuTraffic)
+        {
+            renderGpuTraffic();
+        }
+        else
+        {
+            renderCars(projection);
+            if (useCarLights)
+                renderCarLights(view, projection);
+            if (useBackgroundTraffic)
+                renderBackgroundTraffic();
+            if (useMacroTraffic)
+                renderMacroTraffic();
+            if (useSignals)
+                renderSignals();
+        }
+        if (usePedestrians)
+            renderPedestrians();
+        if (useFlyingTraffic)
+            renderFlyingTraffic();
+        renderXWing(carShaderProgram);
+        if (useShadows)
+            renderShadows(instanceCount);
+        if (useVertexPulling)
+            bindPulledDraws(texture1);
+        submitRenderQueue(renderQueue);
+
+        fenceFrameData();
         updateFPS(window);
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
+    if (replaying)
+    {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - replayStart).count();
+        std::cout << "Replayed " << trafficReplay.frames << " ticks in " << seconds << " s ("
+                  << (trafficReplay.frames > 0 ? seconds * 1000.0 / trafficReplay.frames : 0.0)
+                  << " ms per frame)" << std::endl;
+    }
+    if (recording)
+        closeRecording(trafficRecorder);
+    stopWorkers();
+    stopShaderCompiler();
+
     // Clean up
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
-    glDeleteProgram(shaderProgram);
+    deleteShaderProgram(shaderProgram);
 
     glDeleteVertexArrays(1, &skyboxVAO);
-    glDeleteBuffers(1, &skyboxVBO);
     glDeleteBuffers(1, &instanceVBO);
     glDeleteVertexArrays(1, &roadVAO);
+    if (!useVertexPulling)
+        deleteShaderProgram(roadShaderProgram);
     glDeleteBuffers(1, &roadVBO);
+    for (int i = 0; i < FRAME_DATA_RING; i++)
+    {
+        if (frameDataFence[i])
+            glDeleteSync(frameDataFence[i]);
+    }
+    glDeleteBuffers(1, &frameDataUBO);
+    if (useGpuTraffic)
+        cleanupGpuTraffic();
+    if (useBackgroundTraffic)
+        deleteShaderProgram(carBackgroundShaderProgram);
+    if (useMacroTraffic)
+    {
+        glDeleteVertexArrays(1, &macroCarVAO);
+        glDeleteBuffers(1, &macroInstanceVBO);
+    }
+    if (useGpuTraffic || useMacroTraffic)
+        deleteShaderProgram(carGpuShaderProgram);
+    if (useVertexPulling)
+    {
+        deletePulledGeometry(pulledGeometry);
+        deleteShaderProgram(uberShaderProgram);
+    }
+    if (useHeightFieldShadows)
+        glDeleteTextures(1, &heightFieldTexture);
+    if (useCarLights)
+        deleteLightClusters(carLights);
+    if (useShadows)
+    {
+        deleteShadowCascades(shadowCascades);
+        glDeleteVertexArrays(1, &shadowBuildingVAO);
+        glDeleteBuffers(1, &shadowBuildingVBO);
+        glDeleteVertexArrays(1, &shadowCarVAO);
+        glDeleteBuffers(1, &shadowCarVBO);
+        deleteShaderProgram(shadowBuildingProgram);
+        deleteShaderProgram(shadowCarProgram);
+    }
+    for (std::map<std::string, ShaderProgram>::iterator it = fallbackPrograms.begin(); it != fallbackPrograms.end(); ++it)
+        deleteShaderProgram(it->second);
 
     glfwTerminate();
     return 0;
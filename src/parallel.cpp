@@ -0,0 +1,99 @@
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static std::vector<std::thread> workers;
+static std::mutex jobMutex;
+static std::condition_variable jobReady;
+static std::condition_variable jobDone;
+static const std::function<void(int, int)>* jobBody = NULL;
+static int jobCount = 0;
+static int jobGrain = 1;
+static std::atomic<int> jobNext(0);
+static unsigned int jobGeneration = 0;
+static int workersBusy = 0;
+static bool stopping = false;
+
+static void runChunks() {
+    for (;;) {
+        int begin = jobNext.fetch_add(jobGrain);
+        if (begin >= jobCount) {
+            return;
+        }
+        (*jobBody)(begin, std::min(begin + jobGrain, jobCount));
+    }
+}
+
+static void workerLoop(unsigned int seen) {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(jobMutex);
+            jobReady.wait(lock, [&seen] { return stopping || jobGeneration != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = jobGeneration;
+        }
+        runChunks();
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            if (--workersBusy == 0) {
+                jobDone.notify_one();
+            }
+        }
+    }
+}
+
+void startWorkers(int count) {
+    stopWorkers();
+    for (int i = 1; i < count; i++) {
+        workers.push_back(std::thread(workerLoop, jobGeneration));
+    }
+}
+
+void stopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        stopping = true;
+    }
+    jobReady.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+    workers.clear();
+    stopping = false;
+}
+
+int workerThreads() {
+    return static_cast<int>(workers.size()) + 1;
+}
+
+void parallelFor(int count, const std::function<void(int, int)>& body) {
+    if (count <= 0) {
+        return;
+    }
+    if (workers.empty()) {
+        body(0, count);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        jobBody = &body;
+        jobCount = count;
+        // A few chunks per thread so uneven chunks still balance out
+        jobGrain = std::max(1, count / (workerThreads() * 4));
+        jobNext = 0;
+        workersBusy = static_cast<int>(workers.size());
+        jobGeneration++;
+    }
+    jobReady.notify_all();
+    runChunks();
+
+    std::unique_lock<std::mutex> lock(jobMutex);
+    jobDone.wait(lock, [] { return workersBusy == 0; });
+}
@@ -0,0 +1,17 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <functional>
+
+// Persistent worker threads for data-parallel loops. Without workers,
+// parallelFor() simply runs the loop on the calling thread.
+
+// Run loops on count threads in total, the calling thread included
+void startWorkers(int count);
+void stopWorkers();
+int workerThreads();
+
+// Call body(begin, end) on disjoint chunks covering [0, count) and wait for all of them
+void parallelFor(int count, const std::function<void(int, int)>& body);
+
+#endif
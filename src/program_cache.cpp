@@ -0,0 +1,137 @@
+#include "program_cache.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+static const char CACHE_MAGIC[4] = {'C', 'D', 'P', 'B'};
+static const size_t CACHE_HEADER = 8;  // Magic, then the binary format as 4 little-endian bytes
+
+static ProgramCacheStats stats = {0, 0};
+
+// Without any binary format the driver cannot give programs back
+static bool programCacheSupported() {
+    static int supported = -1;
+    if (supported < 0) {
+        GLint formats = 0;
+        if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary) {
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        }
+        supported = formats > 0 ? 1 : 0;
+    }
+    return supported == 1;
+}
+
+// 64-bit FNV-1a
+static unsigned long long hashText(unsigned long long hash, const char* text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= static_cast<unsigned char>(text[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static unsigned long long hashGlString(unsigned long long hash, GLenum name) {
+    const char* value = reinterpret_cast<const char*>(glGetString(name));
+    std::string text = value ? value : "";
+    return hashText(hash, text.c_str(), text.size() + 1);  // The terminator separates the strings
+}
+
+std::string programCacheKey(const std::string& text) {
+    unsigned long long hash = 14695981039346656037ull;
+    hash = hashGlString(hash, GL_VENDOR);
+    hash = hashGlString(hash, GL_RENDERER);
+    hash = hashGlString(hash, GL_VERSION);
+    hash = hashText(hash, text.c_str(), text.size());
+
+    static const char digits[] = "0123456789abcdef";
+    std::string key(16, '0');
+    for (int i = 15; i >= 0; i--) {
+        key[i] = digits[hash & 0xf];
+        hash >>= 4;
+    }
+    return key;
+}
+
+static std::string cachePath(const std::string& key) {
+    return std::string(PROGRAM_CACHE_DIR) + "/" + key + ".bin";
+}
+
+GLuint loadCachedProgram(const std::string& key) {
+    if (!programCacheSupported()) {
+        stats.misses++;
+        return 0;
+    }
+    std::ifstream file(cachePath(key).c_str(), std::ios::binary);
+    std::vector<char> data;
+    if (file) {
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    if (data.size() <= CACHE_HEADER || !std::equal(CACHE_MAGIC, CACHE_MAGIC + 4, data.begin())) {
+        stats.misses++;
+        return 0;
+    }
+
+    GLenum format = 0;
+    for (int i = 0; i < 4; i++) {
+        format |= static_cast<GLenum>(static_cast<unsigned char>(data[4 + i])) << (8 * i);
+    }
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, format, &data[CACHE_HEADER], static_cast<GLsizei>(data.size() - CACHE_HEADER));
+
+    GLint success = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glDeleteProgram(program);
+        stats.misses++;
+        return 0;
+    }
+    stats.hits++;
+    return program;
+}
+
+void prepareCachedProgram(GLuint program) {
+    if (programCacheSupported()) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+}
+
+void storeCachedProgram(const std::string& key, GLuint program) {
+    GLint length = 0;
+    if (programCacheSupported()) {
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    }
+    if (length <= 0) {
+        return;
+    }
+
+    std::vector<char> data(CACHE_HEADER + length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, &data[CACHE_HEADER]);
+    std::copy(CACHE_MAGIC, CACHE_MAGIC + 4, data.begin());
+    for (int i = 0; i < 4; i++) {
+        data[4 + i] = static_cast<char>((format >> (8 * i)) & 0xff);
+    }
+
+#ifdef _WIN32
+    _mkdir(PROGRAM_CACHE_DIR);
+#else
+    mkdir(PROGRAM_CACHE_DIR, 0755);
+#endif
+    std::ofstream file(cachePath(key).c_str(), std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cerr << "Failed to write program cache entry: " << cachePath(key) << std::endl;
+        return;
+    }
+    file.write(&data[0], CACHE_HEADER + length);
+}
+
+ProgramCacheStats programCacheStats() {
+    return stats;
+}
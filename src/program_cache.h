@@ -0,0 +1,35 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <GL/glew.h>
+#include <string>
+
+// Linked program binaries kept on disk between runs (ARB_get_program_binary),
+// so a launch with unchanged shaders skips compiling and linking them. Each
+// binary is filed under a hash of everything that went into the program and
+// of the driver's vendor, renderer and version strings, since a binary only
+// loads on the driver that produced it. Drivers may still reject one, after
+// an update for instance; the caller then links from source and stores the
+// new binary over it.
+
+const char* const PROGRAM_CACHE_DIR = "program_cache";
+
+struct ProgramCacheStats {
+    int hits;
+    int misses;
+};
+
+// Key for a program built from the given text, such as its sources and varyings
+std::string programCacheKey(const std::string& text);
+
+// A linked program loaded from the cache, or 0 on a miss or when the driver
+// rejects the binary
+GLuint loadCachedProgram(const std::string& key);
+
+// Call before linking a program that is to be stored
+void prepareCachedProgram(GLuint program);
+void storeCachedProgram(const std::string& key, GLuint program);
+
+ProgramCacheStats programCacheStats();
+
+#endif
@@ -0,0 +1,73 @@
+#include "pulled_geometry.h"
+#include "gl_state.h"
+
+static const int INSTANCE_TEXELS = 4;
+
+MeshRange addPulledMesh(PulledGeometry& geometry, const float* vertices, int count, int stride,
+                        int normalOffset, int texCoordOffset) {
+    MeshRange range;
+    range.first = static_cast<GLint>(geometry.vertices.size() / 2);
+    range.count = count;
+    for (int i = 0; i < count; i++) {
+        const float* v = vertices + i * stride;
+        glm::vec3 normal = normalOffset >= 0 ? glm::vec3(v[normalOffset], v[normalOffset + 1], v[normalOffset + 2])
+                                             : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::vec2 texCoords = texCoordOffset >= 0 ? glm::vec2(v[texCoordOffset], v[texCoordOffset + 1])
+                                                  : glm::vec2(0.0f);
+        geometry.vertices.push_back(glm::vec4(v[0], v[1], v[2], texCoords.x));
+        geometry.vertices.push_back(glm::vec4(normal, texCoords.y));
+    }
+    return range;
+}
+
+void uploadPulledMeshes(PulledGeometry& geometry, int persistentInstances) {
+    glGenVertexArrays(1, &geometry.vertexArray);
+    glGenBuffers(1, &geometry.vertexBuffer);
+    glGenTextures(1, &geometry.vertexTexture);
+    createInstanceStore(geometry.instances, INSTANCE_TEXELS, persistentInstances);
+
+    glBindBuffer(GL_TEXTURE_BUFFER, geometry.vertexBuffer);
+    bindTexture(GL_TEXTURE_BUFFER, geometry.vertexTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, geometry.vertexBuffer);
+    bindTexture(GL_TEXTURE_BUFFER, 0);
+    glBufferData(GL_TEXTURE_BUFFER, geometry.vertices.size() * sizeof(glm::vec4), geometry.vertices.data(),
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    std::vector<glm::vec4>().swap(geometry.vertices);
+}
+
+// glm is column major; the shader dots each row with the position
+static void pulledInstanceTexels(const glm::mat4& model, const glm::vec4& appearance, glm::vec4* texels) {
+    glm::mat4 rows = glm::transpose(model);
+    texels[0] = rows[0];
+    texels[1] = rows[1];
+    texels[2] = rows[2];
+    texels[3] = appearance;
+}
+
+void setPulledInstance(PulledGeometry& geometry, int instance, const glm::mat4& model, const glm::vec4& appearance) {
+    pulledInstanceTexels(model, appearance, persistentInstance(geometry.instances, instance));
+}
+
+int addPulledInstance(PulledGeometry& geometry, const glm::mat4& model, const glm::vec4& appearance) {
+    glm::vec4 texels[INSTANCE_TEXELS];
+    pulledInstanceTexels(model, appearance, texels);
+    return addTransientInstance(geometry.instances, texels);
+}
+
+void uploadPulledInstances(PulledGeometry& geometry) {
+    uploadInstanceStore(geometry.instances);
+}
+
+void bindPulledGeometry(const PulledGeometry& geometry, GLenum vertexUnit, GLenum instanceUnit, GLenum indexUnit) {
+    activeTextureUnit(vertexUnit);
+    bindTexture(GL_TEXTURE_BUFFER, geometry.vertexTexture);
+    bindInstanceStore(geometry.instances, instanceUnit, indexUnit);
+}
+
+void deletePulledGeometry(PulledGeometry& geometry) {
+    glDeleteVertexArrays(1, &geometry.vertexArray);
+    glDeleteTextures(1, &geometry.vertexTexture);
+    glDeleteBuffers(1, &geometry.vertexBuffer);
+    deleteInstanceStore(geometry.instances);
+}
@@ -0,0 +1,63 @@
+#ifndef PULLED_GEOMETRY_H
+#define PULLED_GEOMETRY_H
+
+#include "instance_store.h"
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Static meshes in a buffer texture and their instances in an instance store,
+// for the uber shaders to fetch from by gl_VertexID and gl_InstanceID instead
+// of through vertex attributes. Every mesh is drawn with the same program and
+// the same empty vertex array, so draws of different meshes follow each other
+// with no binds in between; only the range of vertices and the first index and
+// material uniforms change.
+//
+// A vertex is two texels: position and u, then normal and v. An instance is
+// four: the first three rows of its model matrix, then its colour and flags.
+
+// Must match the MATERIAL_ constants of uber_vertex_shader.glsl
+enum PulledMaterial {
+    MATERIAL_BUILDING,  // Building texture, lit
+    MATERIAL_ROAD,      // Road texture, unlit
+    MATERIAL_CAR,       // Instance colour, lit, with head and brake lights
+    MATERIAL_WHEEL      // Black, lit
+};
+
+// Instance flags, in the alpha of the colour, as for the instanced car shader
+const int PULLED_MOVING_FORWARD = 1;
+const int PULLED_BRAKING = 2;
+const int PULLED_HEADLIGHTS = 4;
+
+struct MeshRange {
+    GLint first;  // The first argument of the draw, which gl_VertexID starts from
+    GLsizei count;
+};
+
+struct PulledGeometry {
+    std::vector<glm::vec4> vertices;   // Until uploadPulledMeshes()
+    GLuint vertexBuffer, vertexTexture;
+    InstanceStore instances;  // Draws take their firstIndex from its index lists
+    GLuint vertexArray;  // Empty, since a core context cannot draw without one
+};
+
+// Append count vertices of stride floats, positions first. Offsets of -1 mean
+// the mesh has no normals (they point up) or no texture coordinates.
+MeshRange addPulledMesh(PulledGeometry& geometry, const float* vertices, int count, int stride,
+                        int normalOffset, int texCoordOffset);
+// The first persistentInstances records keep their place between frames
+void uploadPulledMeshes(PulledGeometry& geometry, int persistentInstances);
+
+// Write a persistent instance, or add one for this frame only and return its
+// record number; either is drawn by adding it to an index list
+void setPulledInstance(PulledGeometry& geometry, int instance, const glm::mat4& model, const glm::vec4& appearance);
+int addPulledInstance(PulledGeometry& geometry, const glm::mat4& model, const glm::vec4& appearance);
+
+// Upload the frame's instances and index lists; before the draws are submitted
+void uploadPulledInstances(PulledGeometry& geometry);
+
+// Bind the mesh, record and index buffer textures to the given units
+void bindPulledGeometry(const PulledGeometry& geometry, GLenum vertexUnit, GLenum instanceUnit, GLenum indexUnit);
+void deletePulledGeometry(PulledGeometry& geometry);
+
+#endif
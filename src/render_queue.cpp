@@ -0,0 +1,157 @@
+#include "render_queue.h"
+#include "gl_state.h"
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cstring>
+
+DrawPacket drawPacket(ShaderProgram& program, GLuint vertexArray, GLenum mode, GLint first, GLsizei count,
+                      GLsizei instances) {
+    DrawPacket packet;
+    packet.program = &program;
+    packet.vertexArray = vertexArray;
+    packet.textureTarget = GL_TEXTURE_2D;
+    packet.texture = 0;
+    packet.mode = mode;
+    packet.first = first;
+    packet.count = count;
+    packet.instances = instances;
+    packet.firstUniform = 0;
+    packet.uniformCount = 0;
+    return packet;
+}
+
+void packetTexture(DrawPacket& packet, GLenum target, GLuint texture) {
+    packet.textureTarget = target;
+    packet.texture = texture;
+}
+
+// Append a value for the packet, which owns a contiguous run of the queue's values
+static PacketUniform* addPacketUniform(RenderQueue& queue, DrawPacket& packet, const char* name, GLenum type) {
+    int uniform = shaderUniform(*packet.program, name);
+    if (uniform < 0) {
+        return 0;
+    }
+    if (packet.uniformCount == 0) {
+        packet.firstUniform = static_cast<int>(queue.uniforms.size());
+    }
+    packet.uniformCount++;
+    queue.uniforms.push_back(PacketUniform());
+    PacketUniform& value = queue.uniforms.back();
+    value.uniform = uniform;
+    value.type = type;
+    return &value;
+}
+
+void packetUniform(RenderQueue& queue, DrawPacket& packet, const char* name, int value) {
+    PacketUniform* slot = addPacketUniform(queue, packet, name, GL_INT);
+    if (slot) {
+        slot->intValue = value;
+    }
+}
+
+void packetUniform(RenderQueue& queue, DrawPacket& packet, const char* name, const glm::mat4& value) {
+    PacketUniform* slot = addPacketUniform(queue, packet, name, GL_FLOAT_MAT4);
+    if (slot) {
+        memcpy(slot->value, glm::value_ptr(value), sizeof(slot->value));
+    }
+}
+
+uint64_t renderSortKey(RenderPass pass, const DrawPacket& packet, float depth) {
+    const uint64_t idMask = (1u << 10) - 1;
+    const uint64_t depthMask = (1u << 24) - 1;
+    uint64_t quantized = static_cast<uint64_t>(std::min(std::max(depth, 0.0f), 1.0f) * depthMask);
+    return (static_cast<uint64_t>(pass) << 60) |
+           ((packet.program->id & idMask) << 50) |
+           ((packet.texture & idMask) << 40) |
+           ((packet.vertexArray & idMask) << 30) |
+           (quantized << 6);
+}
+
+void pushDraw(RenderQueue& queue, RenderPass pass, float depth, const DrawPacket& packet) {
+    ShaderProgram* drawable = drawableProgram(*packet.program);
+    if (!drawable || packet.count == 0 || packet.instances == 0) {
+        return;
+    }
+    queue.packets.push_back(packet);
+    queue.packets.back().program = drawable;
+    queue.keys.push_back(renderSortKey(pass, queue.packets.back(), depth));
+}
+
+void sortRenderKeys(std::vector<SortEntry>& entries, std::vector<SortEntry>& scratch) {
+    size_t n = entries.size();
+    if (n < 2) {
+        return;
+    }
+    scratch.resize(n);
+
+    // Bits that differ between any two keys; bytes without any are already sorted
+    uint64_t differ = 0;
+    for (size_t i = 1; i < n; i++) {
+        differ |= entries[i].key ^ entries[0].key;
+    }
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        if (((differ >> shift) & 0xff) == 0) {
+            continue;
+        }
+        size_t start[257] = {0};
+        for (size_t i = 0; i < n; i++) {
+            start[((entries[i].key >> shift) & 0xff) + 1]++;
+        }
+        for (int b = 1; b <= 256; b++) {
+            start[b] += start[b - 1];
+        }
+        for (size_t i = 0; i < n; i++) {
+            scratch[start[(entries[i].key >> shift) & 0xff]++] = entries[i];
+        }
+        entries.swap(scratch);
+    }
+}
+
+static void applyPass(RenderPass pass) {
+    // The sky is at the far plane, which only passes where the depth is still clear
+    glDepthFunc(pass == RENDER_PASS_SKY ? GL_LEQUAL : GL_LESS);
+}
+
+void submitRenderQueue(RenderQueue& queue) {
+    queue.entries.resize(queue.packets.size());
+    for (size_t i = 0; i < queue.packets.size(); i++) {
+        queue.entries[i].key = queue.keys[i];
+        queue.entries[i].packet = static_cast<uint32_t>(i);
+    }
+    sortRenderKeys(queue.entries, queue.scratch);
+
+    int pass = -1;
+    for (const SortEntry& entry : queue.entries) {
+        const DrawPacket& packet = queue.packets[entry.packet];
+        int packetPass = static_cast<int>(entry.key >> 60);
+        if (packetPass != pass) {
+            pass = packetPass;
+            applyPass(static_cast<RenderPass>(pass));
+        }
+
+        useShaderProgram(*packet.program);
+        bindVertexArray(packet.vertexArray);
+        if (packet.texture != 0) {
+            activeTextureUnit(GL_TEXTURE0);
+            bindTexture(packet.textureTarget, packet.texture);
+        }
+        for (int u = packet.firstUniform; u < packet.firstUniform + packet.uniformCount; u++) {
+            const PacketUniform& value = queue.uniforms[u];
+            if (value.type == GL_INT) {
+                setUniform(*packet.program, value.uniform, value.intValue);
+            } else {
+                glm::mat4 matrix;
+                memcpy(glm::value_ptr(matrix), value.value, sizeof(value.value));
+                setUniform(*packet.program, value.uniform, matrix);
+            }
+        }
+
+        glDrawArraysInstanced(packet.mode, packet.first, packet.count, packet.instances);
+    }
+    applyPass(RENDER_PASS_OPAQUE);
+
+    queue.packets.clear();
+    queue.keys.clear();
+    queue.uniforms.clear();
+}
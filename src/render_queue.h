@@ -0,0 +1,81 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include "shader_program.h"
+#include <cstdint>
+#include <vector>
+
+// Draws are queued as packets during the frame and submitted together. Each
+// packet gets a 64-bit key, from the top bit down:
+//
+//   pass (4) | program (10) | texture (10) | vertex array (10) | depth (24) | unused (6)
+//
+// and the queue is radix sorted on it, so draws sharing a program, texture and
+// vertex array end up next to each other and front to back within them, and
+// the binds between them are elided. Packets with equal keys keep the order
+// they were pushed in.
+//
+// Uniforms that change per draw travel with the packet. Uniforms a program
+// keeps for the whole frame can be set directly when queueing.
+
+enum RenderPass {
+    RENDER_PASS_OPAQUE,
+    RENDER_PASS_SKY,  // Drawn at the far plane where nothing opaque was
+    RENDER_PASS_COUNT
+};
+
+struct DrawPacket {
+    ShaderProgram* program;
+    GLuint vertexArray;
+    GLenum textureTarget;  // Bound to unit 0 when texture is not 0
+    GLuint texture;
+    GLenum mode;
+    GLint first;
+    GLsizei count;
+    GLsizei instances;     // 1 for a draw that is not instanced
+    int firstUniform;      // The packet's values in RenderQueue::uniforms
+    int uniformCount;
+};
+
+struct PacketUniform {
+    int uniform;  // Index into the program's uniforms
+    GLenum type;  // GL_INT or GL_FLOAT_MAT4
+    int intValue;
+    float value[16];
+};
+
+struct SortEntry {
+    uint64_t key;
+    uint32_t packet;
+};
+
+struct RenderQueue {
+    std::vector<DrawPacket> packets;
+    std::vector<uint64_t> keys;
+    std::vector<PacketUniform> uniforms;
+    std::vector<SortEntry> entries;
+    std::vector<SortEntry> scratch;
+};
+
+DrawPacket drawPacket(ShaderProgram& program, GLuint vertexArray, GLenum mode, GLint first, GLsizei count,
+                      GLsizei instances = 1);
+void packetTexture(DrawPacket& packet, GLenum target, GLuint texture);
+
+// Values for a packet that has not been pushed yet; they are set before it is drawn
+void packetUniform(RenderQueue& queue, DrawPacket& packet, const char* name, int value);
+void packetUniform(RenderQueue& queue, DrawPacket& packet, const char* name, const glm::mat4& value);
+
+// Depth is the distance from the camera over the far plane, clamped to [0, 1].
+// The packet draws with drawableProgram() of its program; packets with nothing
+// to draw, or no program ready to draw them, are dropped.
+uint64_t renderSortKey(RenderPass pass, const DrawPacket& packet, float depth);
+void pushDraw(RenderQueue& queue, RenderPass pass, float depth, const DrawPacket& packet);
+
+// Stable LSD radix sort of the entries by key, a byte at a time, skipping the
+// bytes every key shares
+void sortRenderKeys(std::vector<SortEntry>& entries, std::vector<SortEntry>& scratch);
+
+// Sort and draw everything queued, then empty the queue
+void submitRenderQueue(RenderQueue& queue);
+
+#endif
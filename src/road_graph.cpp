@@ -0,0 +1,284 @@
+#include "road_graph.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+
+static const float UNREACHABLE = 1e30f;
+
+// Shortest travel times between every pair of intersections of one block,
+// using only roads inside the block, and the first hop of each of those paths
+static float blockCost[BLOCK_NODES][BLOCK_NODES];
+static unsigned char blockNext[BLOCK_NODES][BLOCK_NODES];
+
+static int floorDiv(int a, int n) {
+    return (a >= 0) ? a / n : -((-a + n - 1) / n);
+}
+
+static int floorMod(int a, int n) {
+    return a - floorDiv(a, n) * n;
+}
+
+float streetX(int street) {
+    return -30.0f + street * STREET_SPACING;
+}
+
+float crossStreetZ(int cross) {
+    return -ROAD_LENGTH/2 + cross * CROSS_SPACING;
+}
+
+bool streetForward(int street) {
+    return floorMod(street, 2) == 0;
+}
+
+bool crossForward(int cross) {
+    return floorMod(cross, 2) == 0;
+}
+
+static float streetEdgeCost(int street) {
+    return floorMod(street, AVENUE_PERIOD) == 0 ? CROSS_SPACING / AVENUE_SPEEDUP : CROSS_SPACING;
+}
+
+static float crossEdgeCost() {
+    return STREET_SPACING;
+}
+
+static int blockNode(int localStreet, int cross) {
+    return localStreet * NUM_CROSS_STREETS + cross;
+}
+
+// Floyd-Warshall over the 80 intersections of a block; BLOCK_STREETS is a
+// multiple of the direction and avenue periods, so one table fits all blocks
+void initRoadGraph() {
+    for (int i = 0; i < BLOCK_NODES; i++) {
+        for (int j = 0; j < BLOCK_NODES; j++) {
+            blockCost[i][j] = (i == j) ? 0.0f : UNREACHABLE;
+            blockNext[i][j] = static_cast<unsigned char>(j);
+        }
+    }
+    for (int s = 0; s < BLOCK_STREETS; s++) {
+        for (int c = 0; c < NUM_CROSS_STREETS; c++) {
+            int from = blockNode(s, c);
+            int along = blockNode(s, floorMod(c + (streetForward(s) ? 1 : -1), NUM_CROSS_STREETS));
+            blockCost[from][along] = streetEdgeCost(s);
+            int across = s + (crossForward(c) ? 1 : -1);
+            if (across >= 0 && across < BLOCK_STREETS) {
+                blockCost[from][blockNode(across, c)] = crossEdgeCost();
+            }
+        }
+    }
+    for (int k = 0; k < BLOCK_NODES; k++) {
+        for (int i = 0; i < BLOCK_NODES; i++) {
+            if (blockCost[i][k] >= UNREACHABLE) {
+                continue;
+            }
+            for (int j = 0; j < BLOCK_NODES; j++) {
+                float cost = blockCost[i][k] + blockCost[k][j];
+                if (cost < blockCost[i][j]) {
+                    blockCost[i][j] = cost;
+                    blockNext[i][j] = blockNext[i][k];
+                }
+            }
+        }
+    }
+}
+
+void initRouteCache(RouteCache& cache, size_t capacity) {
+    cache.entries.clear();
+    cache.lookup.clear();
+    cache.lookup.reserve(capacity);
+    cache.capacity = capacity;
+    cache.hits = 0;
+    cache.misses = 0;
+}
+
+// Append the path inside one block from a to b (both local node ids), excluding a
+static void appendBlockPath(std::vector<RoadNode>& path, int blockStreet, int a, int b) {
+    while (a != b) {
+        a = blockNext[a][b];
+        RoadNode node = {blockStreet + a / NUM_CROSS_STREETS, a % NUM_CROSS_STREETS};
+        path.push_back(node);
+    }
+}
+
+// Shortest path search over the block boundaries: the first and last street of
+// every block between the start and the destination, plus one block of slack on
+// either side for detours forced by the one-way streets. Inside a block, hops
+// come from the precomputed table, so the search never visits interior nodes.
+static bool searchRoute(RouteCache& cache, RoadNode from, RoadNode to) {
+    int firstBlock = std::min(0, floorDiv(to.street, BLOCK_STREETS)) - 1;
+    int lastBlock = std::max(0, floorDiv(to.street, BLOCK_STREETS)) + 1;
+    int toBlock = floorDiv(to.street, BLOCK_STREETS);
+    int fromLocal = blockNode(from.street, from.cross);
+    int toLocal = blockNode(to.street - toBlock * BLOCK_STREETS, to.cross);
+
+    // Overlay node (block, side, cross); the destination comes last
+    const int perBlock = 2 * NUM_CROSS_STREETS;
+    int target = (lastBlock - firstBlock + 1) * perBlock;
+    cache.cost.assign(target + 1, UNREACHABLE);
+    cache.previous.assign(target + 1, -1);
+    std::vector<float>& cost = cache.cost;
+    std::vector<int>& previous = cache.previous;
+
+    typedef std::pair<float, int> QueueEntry;
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> > queue;
+    for (int side = 0; side < 2; side++) {
+        for (int c = 0; c < NUM_CROSS_STREETS; c++) {
+            int node = (0 - firstBlock) * perBlock + side * NUM_CROSS_STREETS + c;
+            cost[node] = blockCost[fromLocal][blockNode(side * (BLOCK_STREETS - 1), c)];
+            queue.push(QueueEntry(cost[node], node));
+        }
+    }
+    if (toBlock == 0) {
+        cost[target] = blockCost[fromLocal][toLocal];
+        queue.push(QueueEntry(cost[target], target));
+    }
+
+    while (!queue.empty()) {
+        QueueEntry top = queue.top();
+        queue.pop();
+        int node = top.second;
+        if (top.first > cost[node]) {
+            continue;
+        }
+        if (node == target) {
+            break;
+        }
+
+        int block = node / perBlock + firstBlock;
+        int side = (node % perBlock) / NUM_CROSS_STREETS;
+        int c = node % NUM_CROSS_STREETS;
+        int local = blockNode(side * (BLOCK_STREETS - 1), c);
+        int blockBase = (block - firstBlock) * perBlock;
+
+        // Across the block, from the precomputed table
+        for (int otherSide = 0; otherSide < 2; otherSide++) {
+            for (int oc = 0; oc < NUM_CROSS_STREETS; oc++) {
+                int other = blockBase + otherSide * NUM_CROSS_STREETS + oc;
+                float next = top.first + blockCost[local][blockNode(otherSide * (BLOCK_STREETS - 1), oc)];
+                if (next < cost[other]) {
+                    cost[other] = next;
+                    previous[other] = node;
+                    queue.push(QueueEntry(next, other));
+                }
+            }
+        }
+        if (block == toBlock) {
+            float next = top.first + blockCost[local][toLocal];
+            if (next < cost[target]) {
+                cost[target] = next;
+                previous[target] = node;
+                queue.push(QueueEntry(next, target));
+            }
+        }
+
+        // Into the neighbouring block along the cross street
+        int neighbour = -1;
+        if (side == 1 && crossForward(c) && block < lastBlock) {
+            neighbour = blockBase + perBlock + c;
+        } else if (side == 0 && !crossForward(c) && block > firstBlock) {
+            neighbour = blockBase - perBlock + NUM_CROSS_STREETS + c;
+        }
+        if (neighbour >= 0 && top.first + crossEdgeCost() < cost[neighbour]) {
+            cost[neighbour] = top.first + crossEdgeCost();
+            previous[neighbour] = node;
+            queue.push(QueueEntry(cost[neighbour], neighbour));
+        }
+    }
+    if (cost[target] >= UNREACHABLE) {
+        return false;
+    }
+
+    // Walk back over the overlay, then expand every hop into intersections
+    std::vector<int>& overlay = cache.overlay;
+    overlay.clear();
+    for (int node = target; node != -1; node = previous[node]) {
+        overlay.push_back(node);
+    }
+    std::reverse(overlay.begin(), overlay.end());
+
+    cache.path.clear();
+    cache.path.push_back(from);
+    int block = 0;
+    int local = fromLocal;
+    for (size_t i = 0; i < overlay.size(); i++) {
+        int node = overlay[i];
+        int nextBlock, nextLocal;
+        if (node == target) {
+            nextBlock = toBlock;
+            nextLocal = toLocal;
+        } else {
+            nextBlock = node / perBlock + firstBlock;
+            nextLocal = blockNode(((node % perBlock) / NUM_CROSS_STREETS) * (BLOCK_STREETS - 1), node % NUM_CROSS_STREETS);
+        }
+        if (nextBlock == block) {
+            appendBlockPath(cache.path, block * BLOCK_STREETS, local, nextLocal);
+        } else {
+            RoadNode crossing = {nextBlock * BLOCK_STREETS + nextLocal / NUM_CROSS_STREETS, nextLocal % NUM_CROSS_STREETS};
+            cache.path.push_back(crossing);
+        }
+        block = nextBlock;
+        local = nextLocal;
+    }
+    return true;
+}
+
+// Keep only the intersections where the car changes road, and the destination
+static void compressRoute(const std::vector<RoadNode>& path, bool onStreet, Route& route) {
+    route.count = 0;
+    route.next = 0;
+    for (size_t i = 0; i + 1 < path.size(); i++) {
+        bool alongStreet = path[i].street == path[i + 1].street;
+        if (alongStreet != onStreet) {
+            if (route.count == MAX_ROUTE_NODES - 1) {
+                // Too many turns: the route ends at the last one kept and the
+                // car plans again from there
+                return;
+            }
+            route.node[route.count++] = path[i];
+            onStreet = alongStreet;
+        }
+    }
+    route.node[route.count++] = path.back();
+}
+
+bool planRoute(RouteCache& cache, RoadNode from, bool onStreet, RoadNode to, Route& route) {
+    // Translate so the start lies in block 0
+    int offset = floorDiv(from.street, BLOCK_STREETS) * BLOCK_STREETS;
+    from.street -= offset;
+    to.street -= offset;
+    from.cross = floorMod(from.cross, NUM_CROSS_STREETS);
+    to.cross = floorMod(to.cross, NUM_CROSS_STREETS);
+
+    unsigned long long key = (static_cast<unsigned long long>(static_cast<unsigned int>(to.street)) << 32) |
+                             (static_cast<unsigned long long>(to.cross) << 16) |
+                             (static_cast<unsigned long long>(blockNode(from.street, from.cross)) << 1) |
+                             (onStreet ? 1u : 0u);
+    std::unordered_map<unsigned long long, std::list<RouteCache::Entry>::iterator>::iterator found = cache.lookup.find(key);
+    if (found != cache.lookup.end()) {
+        cache.entries.splice(cache.entries.begin(), cache.entries, found->second);
+        route = found->second->route;
+        cache.hits++;
+    } else {
+        cache.misses++;
+        if (!searchRoute(cache, from, to)) {
+            return false;
+        }
+        compressRoute(cache.path, onStreet, route);
+
+        if (cache.entries.size() >= cache.capacity && !cache.entries.empty()) {
+            cache.lookup.erase(cache.entries.back().key);
+            cache.entries.pop_back();
+        }
+        RouteCache::Entry entry;
+        entry.key = key;
+        entry.route = route;
+        cache.entries.push_front(entry);
+        cache.lookup[key] = cache.entries.begin();
+    }
+
+    for (int i = 0; i < route.count; i++) {
+        route.node[i].street += offset;
+    }
+    return true;
+}
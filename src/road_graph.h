@@ -0,0 +1,73 @@
+#ifndef ROAD_GRAPH_H
+#define ROAD_GRAPH_H
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+// Implicit road graph over the infinite city. Streets run along z at every
+// STREET_SPACING in x and go on forever; cross streets run along x at every
+// CROSS_SPACING in z, wrapping with the ROAD_LENGTH ring the cars drive on.
+// Every street meets every cross street at an intersection, which is a node
+// of the graph. All roads are one-way, alternating direction.
+
+const float STREET_SPACING = 4.0f;  // Space between streets
+const float ROAD_LENGTH = 60.0f;  // Match  grid size * 2
+const int NUM_CROSS_STREETS = 10;  // Cross streets around the ring
+const float CROSS_SPACING = ROAD_LENGTH / NUM_CROSS_STREETS;
+const int AVENUE_PERIOD = 4;  // Every fourth street is a faster avenue
+const float AVENUE_SPEEDUP = 1.5f;
+
+// The graph repeats every BLOCK_STREETS streets. Shortest paths inside one
+// block are computed once, and routes are searched over the boundaries of blocks.
+const int BLOCK_STREETS = 8;
+const int BLOCK_NODES = BLOCK_STREETS * NUM_CROSS_STREETS;
+const int MAX_ROUTE_NODES = 16;
+
+struct RoadNode {
+    int street;
+    int cross;
+};
+
+// The intersections where a car changes road, ending with its destination
+struct Route {
+    int count;
+    int next;   // Next node to reach; the route is finished once next == count
+    RoadNode node[MAX_ROUTE_NODES];
+};
+
+// Least recently used cache of routes. Keys are translated to the source's
+// block, so every block of the city shares the same entries.
+struct RouteCache {
+    struct Entry {
+        unsigned long long key;
+        Route route;
+    };
+    std::list<Entry> entries;  // Most recently used first
+    std::unordered_map<unsigned long long, std::list<Entry>::iterator> lookup;
+    size_t capacity;
+    long hits;
+    long misses;
+
+    // Search scratch, reused between misses
+    std::vector<float> cost;
+    std::vector<int> previous;
+    std::vector<int> overlay;
+    std::vector<RoadNode> path;
+};
+
+float streetX(int street);
+float crossStreetZ(int cross);
+bool streetForward(int street);  // Traffic on the street drives towards +z
+bool crossForward(int cross);    // Traffic on the cross street drives towards +x
+
+void initRoadGraph();
+void initRouteCache(RouteCache& cache, size_t capacity);
+
+// Plan a route from an intersection to another. onStreet says whether the car
+// reaches the start along a street or along a cross street, so a turn right
+// there is part of the route. Returns false when no route could be found.
+bool planRoute(RouteCache& cache, RoadNode from, bool onStreet, RoadNode to, Route& route);
+
+#endif
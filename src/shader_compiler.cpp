@@ -0,0 +1,244 @@
+#include "shader_compiler.h"
+#include "program_cache.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static const int MAX_COMPILE_WORKERS = 4;
+
+enum CompileMode {
+    COMPILE_SERIAL,           // On the main thread, before compileProgramAsync() returns
+    COMPILE_PARALLEL_DRIVER,  // KHR_parallel_shader_compile
+    COMPILE_WORKERS           // Worker threads on shared contexts
+};
+
+struct CompileJob {
+    ShaderProgram* program;
+    ShaderSources sources;
+    std::string cacheKey;
+    void (*linked)(GLuint id);
+    GLuint vertex;
+    GLuint fragment;
+    GLuint id;
+    std::atomic<bool> built;  // Workers: linked, and finished on the GPU so the main context sees it
+};
+
+static CompileMode mode = COMPILE_SERIAL;
+static std::list<CompileJob> jobs;  // Queued and not yet finished; a list, so workers can hold on to one
+static std::chrono::steady_clock::time_point startTime;
+
+static std::vector<std::thread> workers;
+static std::vector<GLFWwindow*> workerContexts;
+static std::deque<CompileJob*> waiting;
+static std::mutex waitingMutex;
+static std::condition_variable waitingChanged;
+static bool stopping = false;
+
+static GLuint compileStage(GLenum type, const std::string& code) {
+    const char* source = code.c_str();
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    return shader;
+}
+
+// Issue the compiles and the link without asking for their status, which
+// would wait for them
+static void buildJob(CompileJob& job) {
+    job.vertex = compileStage(GL_VERTEX_SHADER, job.sources.vertex);
+    job.fragment = job.sources.fragment.empty() ? 0 : compileStage(GL_FRAGMENT_SHADER, job.sources.fragment);
+    job.id = glCreateProgram();
+    glAttachShader(job.id, job.vertex);
+    if (job.fragment) {
+        glAttachShader(job.id, job.fragment);
+    }
+    if (job.sources.varying) {
+        // The captured varyings have to be declared before linking
+        glTransformFeedbackVaryings(job.id, 1, &job.sources.varying, GL_INTERLEAVED_ATTRIBS);
+    }
+    prepareCachedProgram(job.id);
+    glLinkProgram(job.id);
+}
+
+static bool jobBuilt(CompileJob& job) {
+    if (mode == COMPILE_PARALLEL_DRIVER) {
+        GLint done = GL_FALSE;
+        glGetProgramiv(job.id, GL_COMPLETION_STATUS_KHR, &done);
+        return done == GL_TRUE;
+    }
+    return job.built.load();
+}
+
+static void reportCompile(GLuint shader, const char* stage) {
+    GLint success;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        GLchar infoLog[512];
+        glGetShaderInfoLog(shader, 512, NULL, infoLog);
+        std::cerr << "ERROR::SHADER::" << stage << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+    }
+}
+
+// Report errors, cache the binary and hand the program over, on the main thread
+static void finishJob(CompileJob& job) {
+    reportCompile(job.vertex, "VERTEX");
+    if (job.fragment) {
+        reportCompile(job.fragment, "FRAGMENT");
+    }
+
+    glDeleteShader(job.vertex);
+    if (job.fragment) {
+        glDeleteShader(job.fragment);
+    }
+
+    GLint success;
+    glGetProgramiv(job.id, GL_LINK_STATUS, &success);
+    if (!success) {
+        // Never made ready, so its fallback keeps drawing in its place
+        GLchar infoLog[512];
+        glGetProgramInfoLog(job.id, 512, NULL, infoLog);
+        std::cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        glDeleteProgram(job.id);
+        return;
+    }
+    storeCachedProgram(job.cacheKey, job.id);
+
+    if (job.linked) {
+        job.linked(job.id);
+    }
+    reflectShaderProgram(*job.program, job.id);
+}
+
+static void compileWorker(GLFWwindow* context) {
+    glfwMakeContextCurrent(context);
+    for (;;) {
+        CompileJob* job;
+        {
+            std::unique_lock<std::mutex> lock(waitingMutex);
+            waitingChanged.wait(lock, [] { return stopping || !waiting.empty(); });
+            if (stopping) {
+                break;
+            }
+            job = waiting.front();
+            waiting.pop_front();
+        }
+        buildJob(*job);
+        glFinish();
+        job->built.store(true);
+    }
+    glfwMakeContextCurrent(NULL);
+}
+
+void startShaderCompiler(GLFWwindow* window) {
+    startTime = std::chrono::steady_clock::now();
+    if (GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile) {
+        // As many threads as the driver likes
+        if (GLEW_KHR_parallel_shader_compile) {
+            glMaxShaderCompilerThreadsKHR(0xffffffffu);
+        } else {
+            glMaxShaderCompilerThreadsARB(0xffffffffu);
+        }
+        mode = COMPILE_PARALLEL_DRIVER;
+        std::cout << "Compiling shaders on the driver's threads" << std::endl;
+        return;
+    }
+
+    // Hidden windows keep the hints the main window was made with, so their
+    // contexts match it
+    int count = std::min(std::max(static_cast<int>(std::thread::hardware_concurrency()), 1), MAX_COMPILE_WORKERS);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    for (int i = 0; i < count; i++) {
+        GLFWwindow* context = glfwCreateWindow(1, 1, "", NULL, window);
+        if (!context) {
+            break;
+        }
+        workerContexts.push_back(context);
+    }
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    glfwMakeContextCurrent(window);
+
+    if (workerContexts.empty()) {
+        std::cout << "Compiling shaders on the main thread" << std::endl;
+        return;
+    }
+    mode = COMPILE_WORKERS;
+    stopping = false;
+    for (GLFWwindow* context : workerContexts) {
+        workers.push_back(std::thread(compileWorker, context));
+    }
+    std::cout << "Compiling shaders on " << workers.size() << " background contexts" << std::endl;
+}
+
+void stopShaderCompiler() {
+    {
+        std::lock_guard<std::mutex> lock(waitingMutex);
+        stopping = true;
+        waiting.clear();
+    }
+    waitingChanged.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+    for (GLFWwindow* context : workerContexts) {
+        glfwDestroyWindow(context);
+    }
+    workerContexts.clear();
+    jobs.clear();
+    mode = COMPILE_SERIAL;
+}
+
+void compileProgramAsync(ShaderProgram& program, const ShaderSources& sources, const std::string& cacheKey,
+                         void (*linked)(GLuint id)) {
+    jobs.emplace_back();
+    CompileJob& job = jobs.back();
+    job.program = &program;
+    job.sources = sources;
+    job.cacheKey = cacheKey;
+    job.linked = linked;
+    job.built.store(false);
+    program.ready = false;
+
+    if (mode == COMPILE_WORKERS) {
+        {
+            std::lock_guard<std::mutex> lock(waitingMutex);
+            waiting.push_back(&job);
+        }
+        waitingChanged.notify_one();
+        return;
+    }
+    buildJob(job);
+    if (mode == COMPILE_SERIAL) {
+        finishJob(job);
+        jobs.pop_back();
+    }
+}
+
+void pollShaderCompiler() {
+    if (jobs.empty()) {
+        return;
+    }
+    for (std::list<CompileJob>::iterator it = jobs.begin(); it != jobs.end();) {
+        if (jobBuilt(*it)) {
+            finishJob(*it);
+            it = jobs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (jobs.empty()) {
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        std::cout << "All shader programs ready after " << static_cast<int>(ms) << " ms" << std::endl;
+    }
+}
+
+int pendingShaderPrograms() {
+    return static_cast<int>(jobs.size());
+}
@@ -0,0 +1,37 @@
+#ifndef SHADER_COMPILER_H
+#define SHADER_COMPILER_H
+
+#include "shader_program.h"
+#include <GLFW/glfw3.h>
+#include <string>
+
+// Programs compiled in the background while the frames go on. With
+// KHR_parallel_shader_compile the driver compiles on its own threads and the
+// main thread polls for completion; otherwise worker threads compile on
+// hidden windows whose contexts share objects with the main one. Either way
+// every program compiles at once, so startup waits for the slowest rather
+// than for all of them, and a program draws with its fallback until it is
+// ready.
+
+struct ShaderSources {
+    std::string vertex;
+    std::string fragment;  // Empty for a vertex-only program
+    const char* varying;   // Captured with transform feedback, or NULL
+};
+
+// Call with the window's context current, before queueing any program
+void startShaderCompiler(GLFWwindow* window);
+void stopShaderCompiler();
+
+// Compile and link a program in the background. A later pollShaderCompiler()
+// stores its binary in the program cache under cacheKey, calls linked(id) if
+// set, and makes the program ready. A program that fails to link is reported
+// and never made ready.
+void compileProgramAsync(ShaderProgram& program, const ShaderSources& sources, const std::string& cacheKey,
+                         void (*linked)(GLuint id));
+
+// Finish the programs that have linked; once per frame on the main thread
+void pollShaderCompiler();
+int pendingShaderPrograms();
+
+#endif
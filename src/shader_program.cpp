@@ -0,0 +1,155 @@
+#include "shader_program.h"
+#include "gl_state.h"
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cstring>
+
+template <typename Entry>
+static bool byName(const Entry& a, const Entry& b) {
+    return a.name < b.name;
+}
+
+void reflectShaderProgram(ShaderProgram& program, GLuint id) {
+    program.id = id;
+    program.ready = true;
+    program.uniforms.clear();
+    program.attributes.clear();
+
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    std::vector<GLchar> name(std::max(maxLength, 1));
+    for (GLint i = 0; i < count; i++) {
+        ShaderUniform uniform;
+        glGetActiveUniform(id, i, static_cast<GLsizei>(name.size()), NULL, &uniform.size, &uniform.type, &name[0]);
+        uniform.location = glGetUniformLocation(id, &name[0]);
+        if (uniform.location == -1) {
+            continue;  // Lives in a uniform block such as FrameData
+        }
+        uniform.name = &name[0];
+        size_t bracket = uniform.name.find('[');
+        if (bracket != std::string::npos) {
+            uniform.name.erase(bracket);
+        }
+        uniform.cached = false;
+        program.uniforms.push_back(uniform);
+    }
+    std::sort(program.uniforms.begin(), program.uniforms.end(), byName<ShaderUniform>);
+
+    glGetProgramiv(id, GL_ACTIVE_ATTRIBUTES, &count);
+    glGetProgramiv(id, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+    name.assign(std::max(maxLength, 1), 0);
+    for (GLint i = 0; i < count; i++) {
+        ShaderAttribute attribute;
+        GLint size;
+        glGetActiveAttrib(id, i, static_cast<GLsizei>(name.size()), NULL, &size, &attribute.type, &name[0]);
+        attribute.name = &name[0];
+        attribute.location = glGetAttribLocation(id, &name[0]);
+        program.attributes.push_back(attribute);
+    }
+    std::sort(program.attributes.begin(), program.attributes.end(), byName<ShaderAttribute>);
+}
+
+ShaderProgram* drawableProgram(ShaderProgram& program) {
+    if (program.ready) {
+        return &program;
+    }
+    if (program.fallback && program.fallback->ready) {
+        return program.fallback;
+    }
+    return NULL;
+}
+
+void useShaderProgram(ShaderProgram& program) {
+    ShaderProgram* drawable = drawableProgram(program);
+    bindProgram(drawable ? drawable->id : 0);
+}
+
+void deleteShaderProgram(ShaderProgram& program) {
+    forgetProgram(program.id);
+    glDeleteProgram(program.id);
+    program.id = 0;
+    program.ready = false;
+    program.uniforms.clear();
+    program.attributes.clear();
+}
+
+int shaderUniform(ShaderProgram& program, const char* name) {
+    ShaderProgram* drawable = drawableProgram(program);
+    if (!drawable) {
+        return -1;
+    }
+    ShaderUniform key;
+    key.name = name;
+    std::vector<ShaderUniform>::const_iterator it =
+        std::lower_bound(drawable->uniforms.begin(), drawable->uniforms.end(), key, byName<ShaderUniform>);
+    if (it == drawable->uniforms.end() || it->name != name) {
+        return -1;
+    }
+    return static_cast<int>(it - drawable->uniforms.begin());
+}
+
+GLint shaderAttribute(const ShaderProgram& program, const char* name) {
+    ShaderAttribute key;
+    key.name = name;
+    std::vector<ShaderAttribute>::const_iterator it =
+        std::lower_bound(program.attributes.begin(), program.attributes.end(), key, byName<ShaderAttribute>);
+    if (it == program.attributes.end() || it->name != name) {
+        return -1;
+    }
+    return it->location;
+}
+
+// Compare a value with the cached one and remember it; true when it has to be uploaded
+static bool changeUniform(ShaderUniform& uniform, const void* value, size_t bytes) {
+    if (uniform.cached && memcmp(uniform.value, value, bytes) == 0) {
+        return false;
+    }
+    memcpy(uniform.value, value, bytes);
+    uniform.cached = true;
+    return true;
+}
+
+void setUniform(ShaderProgram& program, int uniform, int value) {
+    ShaderProgram* drawable = drawableProgram(program);
+    if (uniform >= 0 && drawable && changeUniform(drawable->uniforms[uniform], &value, sizeof(value))) {
+        glUniform1i(drawable->uniforms[uniform].location, value);
+    }
+}
+
+void setUniform(ShaderProgram& program, int uniform, float value) {
+    ShaderProgram* drawable = drawableProgram(program);
+    if (uniform >= 0 && drawable && changeUniform(drawable->uniforms[uniform], &value, sizeof(value))) {
+        glUniform1f(drawable->uniforms[uniform].location, value);
+    }
+}
+
+void setUniform(ShaderProgram& program, int uniform, const glm::vec3& value) {
+    ShaderProgram* drawable = drawableProgram(program);
+    if (uniform >= 0 && drawable && changeUniform(drawable->uniforms[uniform], glm::value_ptr(value), sizeof(value))) {
+        glUniform3fv(drawable->uniforms[uniform].location, 1, glm::value_ptr(value));
+    }
+}
+
+void setUniform(ShaderProgram& program, int uniform, const glm::mat4& value) {
+    ShaderProgram* drawable = drawableProgram(program);
+    if (uniform >= 0 && drawable && changeUniform(drawable->uniforms[uniform], glm::value_ptr(value), sizeof(value))) {
+        glUniformMatrix4fv(drawable->uniforms[uniform].location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+}
+
+void setUniform(ShaderProgram& program, const char* name, int value) {
+    setUniform(program, shaderUniform(program, name), value);
+}
+
+void setUniform(ShaderProgram& program, const char* name, float value) {
+    setUniform(program, shaderUniform(program, name), value);
+}
+
+void setUniform(ShaderProgram& program, const char* name, const glm::vec3& value) {
+    setUniform(program, shaderUniform(program, name), value);
+}
+
+void setUniform(ShaderProgram& program, const char* name, const glm::mat4& value) {
+    setUniform(program, shaderUniform(program, name), value);
+}
@@ -0,0 +1,68 @@
+#ifndef SHADER_PROGRAM_H
+#define SHADER_PROGRAM_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+// A linked program with its active uniforms and attributes, reflected once
+// after linking. Uniforms are looked up in a flat table sorted by name instead
+// of asking the driver each draw, and the setters remember the last value
+// uploaded to each one, so setting the same value again costs no GL call.
+//
+// A program still compiling in the background is not ready. Until it is, the
+// functions below work on its fallback instead, or do nothing without one.
+
+struct ShaderUniform {
+    std::string name;  // Arrays without their "[0]"
+    GLint location;
+    GLenum type;
+    GLint size;        // Elements, for arrays
+    bool cached;       // value holds what the program has
+    float value[16];   // Last value set through the setters below, ints bit-for-bit
+};
+
+struct ShaderAttribute {
+    std::string name;
+    GLint location;
+    GLenum type;
+};
+
+struct ShaderProgram {
+    GLuint id;
+    bool ready;                               // Linked and reflected
+    ShaderProgram* fallback;                  // Drawn with until ready, if set
+    std::vector<ShaderUniform> uniforms;      // Sorted by name
+    std::vector<ShaderAttribute> attributes;  // Sorted by name
+};
+
+// Take over a linked program and reflect its uniforms and attributes, which
+// makes it ready
+void reflectShaderProgram(ShaderProgram& program, GLuint id);
+
+// The program that draws for this one: itself once ready, else its fallback
+// once that is ready, else NULL
+ShaderProgram* drawableProgram(ShaderProgram& program);
+void useShaderProgram(ShaderProgram& program);
+void deleteShaderProgram(ShaderProgram& program);
+
+// Index of an active uniform in the uniforms of drawableProgram(program), or
+// -1 when it has none of that name (the compiler drops unused ones). Resolve
+// hot uniforms once per frame and pass the index to the setters.
+int shaderUniform(ShaderProgram& program, const char* name);
+GLint shaderAttribute(const ShaderProgram& program, const char* name);
+
+// The program must be in use. An index of -1 is ignored.
+void setUniform(ShaderProgram& program, int uniform, int value);
+void setUniform(ShaderProgram& program, int uniform, float value);
+void setUniform(ShaderProgram& program, int uniform, const glm::vec3& value);
+void setUniform(ShaderProgram& program, int uniform, const glm::mat4& value);
+
+// By name, for uniforms set once per frame or less
+void setUniform(ShaderProgram& program, const char* name, int value);
+void setUniform(ShaderProgram& program, const char* name, float value);
+void setUniform(ShaderProgram& program, const char* name, const glm::vec3& value);
+void setUniform(ShaderProgram& program, const char* name, const glm::mat4& value);
+
+#endif
@@ -0,0 +1,114 @@
+#include "shadow_cascades.h"
+#include "gl_state.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <cmath>
+#include <iostream>
+
+// How far past a cascade towards the light its casters can be, enough for
+// the tallest building over the farthest point the cascade shades
+static const float SHADOW_CASTER_REACH = 20.0f;
+
+void createShadowCascades(ShadowCascades& shadows, int resolution, const float splits[SHADOW_CASCADES],
+                          const glm::vec3& lightDirection) {
+    shadows.resolution = resolution;
+    shadows.lightDirection = glm::normalize(lightDirection);
+    glm::vec3 up = fabs(shadows.lightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    shadows.lightRotation = glm::mat3(glm::lookAt(glm::vec3(0.0f), -shadows.lightDirection, up));
+
+    for (int i = 0; i < SHADOW_CASCADES; i++) {
+        ShadowCascade& cascade = shadows.cascades[i];
+        // The margin is the most the snapped centre can lag behind the
+        // camera, on either side
+        float margin = splits[i] * (i == 0 ? 0.05f : 0.25f);
+        cascade.split = splits[i];
+        cascade.radius = splits[i] + margin;
+        cascade.texelSize = 2.0f * cascade.radius / resolution;
+        cascade.snap = i == 0 ? cascade.texelSize : cascade.texelSize * floor(margin / cascade.texelSize);
+        cascade.center = glm::vec3(1e30f);
+        cascade.lightViewProjection = glm::mat4(1.0f);
+        cascade.dirty = true;
+    }
+
+    glGenTextures(1, &shadows.depthTexture);
+    bindTexture(GL_TEXTURE_2D_ARRAY, shadows.depthTexture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, SHADOW_CASCADES, 0,
+                 GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    // Compared in the sampler, with the four nearest texels filtered together
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    bindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    glGenFramebuffers(1, &shadows.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, shadows.framebuffer);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadows.depthTexture, 0, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "ERROR::SHADOWS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void deleteShadowCascades(ShadowCascades& shadows) {
+    glDeleteFramebuffers(1, &shadows.framebuffer);
+    glDeleteTextures(1, &shadows.depthTexture);
+}
+
+void updateShadowCascades(ShadowCascades& shadows, const glm::vec3& cameraPos) {
+    glm::vec3 eye = shadows.lightRotation * cameraPos;
+    for (int i = 0; i < SHADOW_CASCADES; i++) {
+        ShadowCascade& cascade = shadows.cascades[i];
+        glm::vec3 center = glm::floor(eye / cascade.snap + 0.5f) * cascade.snap;
+        if (i == 0 || center != cascade.center) {
+            cascade.center = center;
+            cascade.dirty = true;
+        }
+
+        // The light looks down -z, so nearer the light is further up z
+        float r = cascade.radius;
+        glm::mat4 projection = glm::ortho(center.x - r, center.x + r, center.y - r, center.y + r,
+                                          -(center.z + r + SHADOW_CASTER_REACH), -(center.z - r));
+        cascade.lightViewProjection = projection * glm::mat4(shadows.lightRotation);
+    }
+}
+
+bool boxInShadowCascade(const ShadowCascades& shadows, int cascade, const glm::vec3& center,
+                        const glm::vec3& halfSize) {
+    const ShadowCascade& c = shadows.cascades[cascade];
+    const glm::mat3& rotation = shadows.lightRotation;
+    glm::vec3 lightCenter = rotation * center;
+    glm::vec3 extent = glm::mat3(glm::abs(rotation[0]), glm::abs(rotation[1]), glm::abs(rotation[2])) * halfSize;
+    glm::vec3 low = c.center - glm::vec3(c.radius, c.radius, c.radius);
+    glm::vec3 high = c.center + glm::vec3(c.radius, c.radius, c.radius + SHADOW_CASTER_REACH);
+    return lightCenter.x + extent.x >= low.x && lightCenter.x - extent.x <= high.x &&
+           lightCenter.y + extent.y >= low.y && lightCenter.y - extent.y <= high.y &&
+           lightCenter.z + extent.z >= low.z && lightCenter.z - extent.z <= high.z;
+}
+
+void invalidateShadowCasters(ShadowCascades& shadows, const glm::vec3& center, const glm::vec3& halfSize) {
+    for (int i = 0; i < SHADOW_CASCADES; i++) {
+        if (!shadows.cascades[i].dirty && boxInShadowCascade(shadows, i, center, halfSize)) {
+            shadows.cascades[i].dirty = true;
+        }
+    }
+}
+
+void beginShadowCascade(ShadowCascades& shadows, int cascade) {
+    glBindFramebuffer(GL_FRAMEBUFFER, shadows.framebuffer);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadows.depthTexture, 0, cascade);
+    glViewport(0, 0, shadows.resolution, shadows.resolution);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    shadows.cascades[cascade].dirty = false;
+}
+
+void endShadowCascades(int windowWidth, int windowHeight) {
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, windowWidth, windowHeight);
+}
@@ -0,0 +1,62 @@
+#ifndef SHADOW_CASCADES_H
+#define SHADOW_CASCADES_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Cascaded shadow maps for a directional light, in the layers of one depth
+// texture array. Cascade i covers what is closer to the camera than its split
+// distance and not closer than the previous one's.
+//
+// Each cascade is an orthographic box of fixed size around the camera, facing
+// the light. Its centre is snapped to a grid in light space, so the texels stay
+// put while the camera moves and the shadow edges do not shimmer. The near
+// cascade snaps to single texels and is drawn every frame, with the cars. The
+// others snap to a quarter of their split distance, are made larger by that
+// much so they still cover the split, and keep their contents until the
+// camera crosses a grid line or a caster inside them changes. Since their
+// boxes only move with the camera, turning around redraws nothing.
+
+const int SHADOW_CASCADES = 3;
+
+struct ShadowCascade {
+    float split;       // View distance the cascade covers to
+    float radius;      // Half the width of its box
+    float texelSize;   // World units per shadow map texel
+    float snap;        // Grid its centre is snapped to
+    glm::vec3 center;  // Snapped, in light space
+    glm::mat4 lightViewProjection;
+    bool dirty;        // Needs drawing again
+};
+
+struct ShadowCascades {
+    int resolution;
+    glm::vec3 lightDirection;  // Towards the light
+    glm::mat3 lightRotation;   // World to light space, the light looking down -z
+    GLuint depthTexture;       // GL_TEXTURE_2D_ARRAY, a layer per cascade
+    GLuint framebuffer;
+    ShadowCascade cascades[SHADOW_CASCADES];
+};
+
+void createShadowCascades(ShadowCascades& shadows, int resolution, const float splits[SHADOW_CASCADES],
+                          const glm::vec3& lightDirection);
+void deleteShadowCascades(ShadowCascades& shadows);
+
+// Move the cascades with the camera, marking those whose snapped centre moved.
+// The near cascade is always marked.
+void updateShadowCascades(ShadowCascades& shadows, const glm::vec3& cameraPos);
+
+// Whether a box may cast a shadow into a cascade
+bool boxInShadowCascade(const ShadowCascades& shadows, int cascade, const glm::vec3& center,
+                        const glm::vec3& halfSize);
+
+// Mark the cascades a caster that appeared, moved or changed size falls in
+void invalidateShadowCasters(ShadowCascades& shadows, const glm::vec3& center, const glm::vec3& halfSize);
+
+// Render into a cascade's layer, cleared, which clears its dirty mark. Depth
+// is offset by the slope against acne until endShadowCascades(), which also
+// restores the window's framebuffer and viewport.
+void beginShadowCascade(ShadowCascades& shadows, int cascade);
+void endShadowCascades(int windowWidth, int windowHeight);
+
+#endif
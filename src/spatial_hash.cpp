@@ -0,0 +1,66 @@
+#include "spatial_hash.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+
+void initSpatialHash(SpatialHash& hash, float cellSize, int capacity) {
+    // About two buckets per point keeps the chains short
+    int bits = 3;
+    while ((1u << bits) < static_cast<unsigned int>(capacity) * 2u && bits < 30) {
+        bits++;
+    }
+    hash.cellSize = cellSize;
+    hash.yBits = std::max(1, bits / 6);
+    hash.zBits = (bits - hash.yBits) / 2;
+    hash.xBits = bits - hash.yBits - hash.zBits;
+    hash.key.reserve(capacity);
+    hash.bucketStart.assign((1u << bits) + 1, 0);
+    hash.entries.reserve(capacity);
+    hash.sorted.reserve(capacity);
+}
+
+int spatialCell(const SpatialHash& hash, float coordinate) {
+    return static_cast<int>(floor(coordinate / hash.cellSize));
+}
+
+unsigned int spatialBucket(const SpatialHash& hash, int cx, int cy, int cz) {
+    unsigned int x = static_cast<unsigned int>(cx) & ((1u << hash.xBits) - 1);
+    unsigned int y = static_cast<unsigned int>(cy) & ((1u << hash.yBits) - 1);
+    unsigned int z = static_cast<unsigned int>(cz) & ((1u << hash.zBits) - 1);
+    return (((y << hash.zBits) | z) << hash.xBits) | x;
+}
+
+// points[i * stride] is the position of point i, so arrays of structs can be
+// hashed in place
+void buildSpatialHash(SpatialHash& hash, const glm::vec3* points, int count, int stride) {
+    hash.key.resize(count);
+    const char* base = reinterpret_cast<const char*>(points);
+    parallelFor(count, [&hash, base, stride](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            const glm::vec3& p = *reinterpret_cast<const glm::vec3*>(base + static_cast<size_t>(i) * stride);
+            hash.key[i] = spatialBucket(hash, spatialCell(hash, p.x), spatialCell(hash, p.y), spatialCell(hash, p.z));
+        }
+    });
+
+    // Counting sort by bucket
+    std::vector<int>& start = hash.bucketStart;
+    std::fill(start.begin(), start.end(), 0);
+    for (int i = 0; i < count; i++) {
+        start[hash.key[i] + 1]++;
+    }
+    for (size_t b = 1; b < start.size(); b++) {
+        start[b] += start[b - 1];
+    }
+    hash.entries.resize(count);
+    hash.sorted.resize(count);
+    for (int i = 0; i < count; i++) {
+        int e = start[hash.key[i]]++;
+        hash.entries[e] = i;
+        hash.sorted[e] = *reinterpret_cast<const glm::vec3*>(base + static_cast<size_t>(i) * stride);
+    }
+    // The scatter advanced every start to the next bucket's; shift them back
+    for (size_t b = start.size() - 1; b > 0; b--) {
+        start[b] = start[b - 1];
+    }
+    start[0] = 0;
+}
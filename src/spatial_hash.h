@@ -0,0 +1,54 @@
+#ifndef SPATIAL_HASH_H
+#define SPATIAL_HASH_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Unbounded 3D grid of cubic cells folded into a power-of-two bucket table.
+// Cell coordinates wrap around a box of buckets rather than being scrambled,
+// so neighbouring cells land in neighbouring buckets and a sweep over the
+// points in bucket order keeps its queries in cache. The box is flat, as the
+// things hashed spread much further sideways than up. Cells a box apart share
+// a bucket; callers check the real distance.
+//
+// The table is rebuilt from scratch every tick with a counting sort, with the
+// positions copied in bucket order so a query reads each bucket in one run.
+
+struct SpatialHash {
+    float cellSize;
+    int xBits, yBits, zBits;        // Size of the bucket box, as powers of two
+    std::vector<unsigned int> key;  // Bucket of each point
+    std::vector<int> bucketStart;   // Start of each bucket in entries, plus an end marker
+    std::vector<int> entries;       // Point indices, bucket by bucket
+    std::vector<glm::vec3> sorted;  // Point positions, in the order of entries
+};
+
+void initSpatialHash(SpatialHash& hash, float cellSize, int capacity);
+int spatialCell(const SpatialHash& hash, float coordinate);
+unsigned int spatialBucket(const SpatialHash& hash, int cx, int cy, int cz);
+void buildSpatialHash(SpatialHash& hash, const glm::vec3* points, int count, int stride);
+
+// Call visit(index, position) for every point in the buckets of the cells
+// overlapping the box [low, high]. A box wider than the bucket box is clipped
+// to it, so no bucket is visited twice.
+template <typename Visit>
+void querySpatialHash(const SpatialHash& hash, const glm::vec3& low, const glm::vec3& high, Visit visit) {
+    int lowX = spatialCell(hash, low.x), lowY = spatialCell(hash, low.y), lowZ = spatialCell(hash, low.z);
+    int highX = std::min(spatialCell(hash, high.x), lowX + (1 << hash.xBits) - 1);
+    int highY = std::min(spatialCell(hash, high.y), lowY + (1 << hash.yBits) - 1);
+    int highZ = std::min(spatialCell(hash, high.z), lowZ + (1 << hash.zBits) - 1);
+    for (int y = lowY; y <= highY; y++) {
+        for (int z = lowZ; z <= highZ; z++) {
+            for (int x = lowX; x <= highX; x++) {
+                unsigned int bucket = spatialBucket(hash, x, y, z);
+                for (int e = hash.bucketStart[bucket]; e < hash.bucketStart[bucket + 1]; e++) {
+                    visit(hash.entries[e], hash.sorted[e]);
+                }
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,113 @@
+#include "timer_wheel.h"
+#include <algorithm>
+
+void initTimerWheel(TimerWheel& wheel, int capacity, long now) {
+    wheel.timers.resize(capacity);
+    wheel.freeTimers.resize(capacity);
+    for (int i = 0; i < capacity; i++) {
+        wheel.timers[i].slot = -1;
+        wheel.freeTimers[i] = capacity - 1 - i;
+    }
+    for (int i = 0; i < TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS; i++) {
+        wheel.heads[i] = -1;
+    }
+    wheel.now = now;
+}
+
+static void linkTimer(TimerWheel& wheel, int timer) {
+    TimerWheel::Timer& t = wheel.timers[timer];
+    long delta = t.due - wheel.now;  // 0 only while cascading, just before the slot of now is processed
+
+    // Pick the lowest level whose span still reaches the due tick
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1L << ((level + 1) * TIMER_WHEEL_BITS))) {
+        level++;
+    }
+    long due = t.due;
+    if (level == TIMER_WHEEL_LEVELS - 1 && delta >= (1L << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS))) {
+        due = wheel.now + (1L << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1;  // Clamp far timers
+    }
+    int slot = level * TIMER_WHEEL_SLOTS + static_cast<int>((due >> (level * TIMER_WHEEL_BITS)) & (TIMER_WHEEL_SLOTS - 1));
+
+    t.slot = slot;
+    t.prev = -1;
+    t.next = wheel.heads[slot];
+    if (t.next != -1) {
+        wheel.timers[t.next].prev = timer;
+    }
+    wheel.heads[slot] = timer;
+}
+
+static void unlinkTimer(TimerWheel& wheel, int timer) {
+    TimerWheel::Timer& t = wheel.timers[timer];
+    if (t.prev != -1) {
+        wheel.timers[t.prev].next = t.next;
+    } else {
+        wheel.heads[t.slot] = t.next;
+    }
+    if (t.next != -1) {
+        wheel.timers[t.next].prev = t.prev;
+    }
+}
+
+int scheduleTimer(TimerWheel& wheel, long due, int payload) {
+    if (wheel.freeTimers.empty()) {
+        return -1;
+    }
+    int timer = wheel.freeTimers.back();
+    wheel.freeTimers.pop_back();
+    wheel.timers[timer].due = std::max(due, wheel.now + 1);  // Ticks already processed fire on the next one
+    wheel.timers[timer].payload = payload;
+    linkTimer(wheel, timer);
+    return timer;
+}
+
+void cancelTimer(TimerWheel& wheel, int timer) {
+    if (timer < 0 || wheel.timers[timer].slot == -1) {
+        return;
+    }
+    unlinkTimer(wheel, timer);
+    wheel.timers[timer].slot = -1;
+    wheel.freeTimers.push_back(timer);
+}
+
+// Move every timer of a higher level slot down to where it now belongs
+static void cascade(TimerWheel& wheel, int level) {
+    int slot = level * TIMER_WHEEL_SLOTS + static_cast<int>((wheel.now >> (level * TIMER_WHEEL_BITS)) & (TIMER_WHEEL_SLOTS - 1));
+    int timer = wheel.heads[slot];
+    wheel.heads[slot] = -1;
+    while (timer != -1) {
+        int next = wheel.timers[timer].next;
+        linkTimer(wheel, timer);
+        timer = next;
+    }
+}
+
+void advanceTimerWheel(TimerWheel& wheel, long now, std::vector<int>& expired) {
+    while (wheel.now < now) {
+        wheel.now++;
+
+        // At the start of each turn of a level, bring the current slot of the
+        // level above down. Higher levels go first, so their timers can still
+        // land in the lower slots about to be cascaded.
+        int top = 0;
+        while (top + 1 < TIMER_WHEEL_LEVELS && (wheel.now & ((1L << ((top + 1) * TIMER_WHEEL_BITS)) - 1)) == 0) {
+            top++;
+        }
+        for (int level = top; level >= 1; level--) {
+            cascade(wheel, level);
+        }
+
+        int slot = static_cast<int>(wheel.now & (TIMER_WHEEL_SLOTS - 1));
+        int timer = wheel.heads[slot];
+        wheel.heads[slot] = -1;
+        while (timer != -1) {
+            TimerWheel::Timer& t = wheel.timers[timer];
+            int next = t.next;
+            t.slot = -1;
+            wheel.freeTimers.push_back(timer);
+            expired.push_back(t.payload);
+            timer = next;
+        }
+    }
+}
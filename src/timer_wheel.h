@@ -0,0 +1,36 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <vector>
+
+// Hierarchical timer wheel counting in ticks. Level 0 has one slot per tick,
+// each higher level one slot per full turn of the level below; timers move
+// down a level when their turn comes. Advancing the wheel costs time only for
+// the timers that expire or move, however many are pending.
+
+const int TIMER_WHEEL_BITS = 6;
+const int TIMER_WHEEL_SLOTS = 1 << TIMER_WHEEL_BITS;
+const int TIMER_WHEEL_LEVELS = 4;  // 2^24 ticks ahead
+
+struct TimerWheel {
+    struct Timer {
+        long due;
+        int payload;
+        int next;   // Doubly linked list of the slot, -1 terminated
+        int prev;
+        int slot;   // Index into heads, -1 when the timer is free
+    };
+    std::vector<Timer> timers;
+    std::vector<int> freeTimers;
+    int heads[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS];
+    long now;   // Last tick processed
+};
+
+void initTimerWheel(TimerWheel& wheel, int capacity, long now);
+// Returns the timer id, or -1 when every timer is in use
+int scheduleTimer(TimerWheel& wheel, long due, int payload);
+void cancelTimer(TimerWheel& wheel, int timer);
+// Process every tick up to and including now, appending the payloads of expired timers
+void advanceTimerWheel(TimerWheel& wheel, long now, std::vector<int>& expired);
+
+#endif
@@ -0,0 +1,387 @@
+#include "traffic.h"
+#include "parallel.h"
+#include "traffic_signals.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+
+unsigned int trafficSeed = 0;
+
+void initCarPool(CarPool& pool, int capacity) {
+    pool.slots.assign(capacity, Car());
+    pool.freeSlots.resize(capacity);
+    for (int i = 0; i < capacity; i++) {
+        pool.freeSlots[i] = capacity - 1 - i;
+    }
+    pool.active.clear();
+    pool.active.reserve(capacity);
+    pool.activeIndex.assign(capacity, -1);
+    pool.routes.assign(capacity, Route());
+    pool.revision++;
+}
+
+// Take a slot from the free list, or NULL when the pool is exhausted
+Car* spawnCar(CarPool& pool) {
+    if (pool.freeSlots.empty()) {
+        return NULL;
+    }
+    int slot = pool.freeSlots.back();
+    pool.freeSlots.pop_back();
+    pool.activeIndex[slot] = static_cast<int>(pool.active.size());
+    pool.active.push_back(slot);
+    pool.revision++;
+    pool.slots[slot].cross = -1;
+    pool.routes[slot].count = 0;
+    pool.routes[slot].next = 0;
+    return &pool.slots[slot];
+}
+
+// Return a slot to the free list; the last active slot fills its place in the active list
+void despawnCar(CarPool& pool, int slot) {
+    int index = pool.activeIndex[slot];
+    int last = pool.active.back();
+    pool.active[index] = last;
+    pool.activeIndex[last] = index;
+    pool.active.pop_back();
+    pool.activeIndex[slot] = -1;
+    pool.freeSlots.push_back(slot);
+    pool.revision++;
+}
+
+int wrapIndex(int a, int n) {
+    return ((a % n) + n) % n;
+}
+
+// Alternate colors for visual variety
+glm::vec3 streetColor(int street) {
+    int colorIndex = wrapIndex(street, 3);
+    if (colorIndex == 0) {
+        return glm::vec3(0.8f, 0.2f, 0.2f);  // Red
+    } else if (colorIndex == 1) {
+        return glm::vec3(0.2f, 0.2f, 0.8f);  // Blue
+    }
+    return glm::vec3(0.8f, 0.8f, 0.8f);  // Silver
+}
+
+// Integer hash shared with car_background_vertex_shader.glsl
+unsigned int trafficHash(unsigned int v) {
+    unsigned int h = v * 747796405u + 2891336453u;
+    h = ((h >> ((h >> 28u) + 4u)) ^ h) * 277803737u;
+    return (h >> 22u) ^ h;
+}
+
+float unitRandom(unsigned int& state) {
+    state = trafficHash(state);
+    return static_cast<float>(state & 0xffffu) / 65536.0f;
+}
+
+// Cruising speeds are a hash of the car and the tick rather than rand(), so the
+// traffic never shifts the building heights drawn from rand(), a replay rebuilds
+// the same city, and the result does not depend on how many threads ran the tick
+float randomCruiseSpeed(int slot, long tick) {
+    unsigned int h = trafficHash(trafficHash(static_cast<unsigned int>(slot) + trafficSeed) +
+                                 static_cast<unsigned int>(tick));
+    return 0.02f + static_cast<float>(h & 0xffffu) / 65535.0f * 0.02f;
+}
+
+// Cruising speed of every background car on a street
+float backgroundStreetSpeed(int street) {
+    unsigned int h = trafficHash(static_cast<unsigned int>(street + 0x100000));
+    return 0.02f + static_cast<float>(h & 0xffffu) / 65535.0f * 0.02f;
+}
+
+// Closed-form z of a background car after a number of ticks, including the ROAD_LENGTH wrap
+float backgroundCarZ(int street, int slot, long tick) {
+    unsigned int h = trafficHash(static_cast<unsigned int>(street + 0x100000));
+    float spacing = ROAD_LENGTH / CARS_PER_STREET;
+    float phase = static_cast<float>((h >> 16u) & 0xffffu) / 65535.0f * spacing;
+    double travel = slot * spacing + phase + static_cast<double>(backgroundStreetSpeed(street)) * tick;
+    travel -= ROAD_LENGTH * floor(travel / ROAD_LENGTH);
+    bool forward = (street % 2 == 0);
+    return forward ? static_cast<float>(travel) - ROAD_LENGTH/2 : ROAD_LENGTH/2 - static_cast<float>(travel);
+}
+
+// Bucket of a car's road: streets first, then the cross streets
+static int roadBucket(const Car& car, int firstStreet, int streets) {
+    return car.cross >= 0 ? streets + car.cross : car.street - firstStreet;
+}
+
+// Position of a car along its road
+static float roadPosition(const Car& car) {
+    return car.cross >= 0 ? car.position.x : car.position.z;
+}
+
+// Group the active slots by road with a counting sort. Only needed when cars
+// spawn, despawn or turn; otherwise the grouping is reused tick after tick.
+static void groupByStreet(const CarPool& pool, TrafficScratch& scratch) {
+    int firstStreet = INT_MAX, lastStreet = INT_MIN;
+    for (int slot : pool.active) {
+        if (pool.slots[slot].cross < 0) {
+            firstStreet = std::min(firstStreet, pool.slots[slot].street);
+            lastStreet = std::max(lastStreet, pool.slots[slot].street);
+        }
+    }
+    int streets = (firstStreet <= lastStreet) ? lastStreet - firstStreet + 1 : 0;
+
+    std::vector<int>& offsets = scratch.streetOffset;
+    offsets.assign(streets + NUM_CROSS_STREETS + 1, 0);
+    for (int slot : pool.active) {
+        offsets[roadBucket(pool.slots[slot], firstStreet, streets) + 1]++;
+    }
+    scratch.streetBegin.clear();
+    for (size_t i = 1; i < offsets.size(); i++) {
+        if (offsets[i] > 0) {
+            scratch.streetBegin.push_back(offsets[i - 1]);
+        }
+        offsets[i] += offsets[i - 1];
+    }
+    scratch.streetBegin.push_back(static_cast<int>(pool.active.size()));
+
+    scratch.order.resize(pool.active.size());
+    for (int slot : pool.active) {
+        scratch.order[offsets[roadBucket(pool.slots[slot], firstStreet, streets)]++] = slot;
+    }
+    scratch.firstStreet = firstStreet;
+    scratch.streets = streets;
+    scratch.revision = pool.revision;
+}
+
+// Distance left to the stop line of a red light ahead of the car. FLT_MAX when
+// the light ahead is green or unlit, or when the car is already past the stop
+// line and has to clear the intersection.
+static float distanceToRedLight(const Car& car, const TrafficSignals* signals) {
+    if (signals == NULL) {
+        return FLT_MAX;
+    }
+    int street, cross;
+    float distance;
+    if (car.cross < 0) {
+        float along = car.position.z + ROAD_LENGTH/2;
+        int next = static_cast<int>(car.movingForward ? ceil(along / CROSS_SPACING) : floor(along / CROSS_SPACING));
+        distance = fabs(next * CROSS_SPACING - along);
+        street = car.street;
+        cross = wrapIndex(next, NUM_CROSS_STREETS);
+    } else {
+        float along = car.position.x + 30.0f;
+        street = static_cast<int>(car.movingForward ? ceil(along / STREET_SPACING) : floor(along / STREET_SPACING));
+        distance = fabs(streetX(street) - car.position.x);
+        cross = car.cross;
+    }
+
+    // A little slack, so a car held exactly at the stop line stays behind it
+    if (distance < SIGNAL_STOP_DISTANCE - 0.05f || !signalRed(*signals, street, cross, car.cross < 0)) {
+        return FLT_MAX;
+    }
+    return std::max(0.0f, distance - SIGNAL_STOP_DISTANCE);
+}
+
+// Sort one road and let every car react to the car ahead of it. The order is
+// left sorted, so next tick's insertion sort only has to move the few cars
+// that wrapped around the end of the road.
+static void followStreet(CarPool& pool, int* order, int count, long tick, bool followBackground,
+                         const TrafficSignals* signals) {
+    std::vector<Car>& slots = pool.slots;
+    for (int i = 1; i < count; i++) {
+        int slot = order[i];
+        float position = roadPosition(slots[slot]);
+        int j = i;
+        while (j > 0 && roadPosition(slots[order[j - 1]]) > position) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = slot;
+    }
+
+    // A car alone on its road has nobody to react to, only red lights
+    if (count < 2 && signals == NULL) {
+        return;
+    }
+
+    // Streets are rings; cross streets go on forever, so their lead car has a free road
+    bool ring = slots[order[0]].cross < 0;
+    for (int i = 0; i < count; i++) {
+        Car& car = slots[order[i]];
+        float gap = FLT_MAX;
+        if (car.movingForward) {
+            if (i + 1 < count) {
+                gap = roadPosition(slots[order[i + 1]]) - roadPosition(car);
+            } else if (ring) {
+                gap = roadPosition(slots[order[0]]) + ROAD_LENGTH - roadPosition(car);
+            }
+        } else {
+            if (i > 0) {
+                gap = roadPosition(car) - roadPosition(slots[order[i - 1]]);
+            } else if (ring) {
+                gap = roadPosition(car) + ROAD_LENGTH - roadPosition(slots[order[count - 1]]);
+            }
+        }
+
+        if (count < 2) {
+            gap = FLT_MAX;
+        }
+        gap = std::min(gap, distanceToRedLight(car, signals));
+        if (count < 2 && gap >= BRAKING_DISTANCE && !car.brakingLights) {
+            continue;  // Keep going as before
+        }
+
+        if (gap < BRAKING_DISTANCE) { // Too close
+            car.speed *= 0.95f; // Slow down
+            car.brakingLights = true;
+        } else if (followBackground) {
+            car.speed = backgroundStreetSpeed(car.street); // Keep in step with the background shader
+            car.brakingLights = false;
+        } else {
+            car.speed = randomCruiseSpeed(order[i], tick); // Resume normal speed
+            car.brakingLights = false;
+        }
+    }
+}
+
+// Distance a car still has to drive along its road to reach an intersection,
+// or -1 when the intersection is not on its road
+static float distanceToNode(const Car& car, const RoadNode& node) {
+    if (car.cross < 0) {
+        if (node.street != car.street) {
+            return -1.0f;
+        }
+        float distance = crossStreetZ(node.cross) - car.position.z;
+        if (!car.movingForward) {
+            distance = -distance;
+        }
+        return distance - ROAD_LENGTH * floor(distance / ROAD_LENGTH);
+    }
+    if (node.cross != car.cross) {
+        return -1.0f;
+    }
+    float distance = streetX(node.street) - car.position.x;
+    return car.movingForward ? distance : -distance;
+}
+
+// Move a car along its road, turning at the intersections of its route.
+// Returns true when the car ended up on another road.
+static bool driveCar(Car& car, Route& route, float step) {
+    bool turned = false;
+    while (route.next < route.count) {
+        const RoadNode& node = route.node[route.next];
+        float distance = distanceToNode(car, node);
+        if (distance < 0.0f) {
+            route.next = route.count;  // Off the route; wait for a new one
+            break;
+        }
+        if (distance > step) {
+            break;
+        }
+
+        // Reached the intersection; the last one is the destination
+        step -= distance;
+        car.position.x = streetX(node.street);
+        car.position.z = crossStreetZ(node.cross);
+        car.street = node.street;
+        route.next++;
+        if (route.next < route.count) {
+            if (car.cross < 0) {
+                car.cross = node.cross;
+                car.movingForward = crossForward(node.cross);
+            } else {
+                car.cross = -1;
+                car.movingForward = streetForward(node.street);
+            }
+            turned = true;
+        }
+    }
+
+    float moveAmount = car.movingForward ? step : -step;
+    if (car.cross >= 0) {
+        car.position.x += moveAmount;
+        car.street = static_cast<int>(floor((car.position.x + 30.0f) / STREET_SPACING + 0.5f));
+        return turned;
+    }
+    car.position.z += moveAmount;
+
+    // Wrap around when reaching the ends, keeping the overshoot so the
+    // position stays in step with backgroundCarZ()
+    if(car.position.z > ROAD_LENGTH/2) {
+        car.position.z -= ROAD_LENGTH;
+    } else if(car.position.z < -ROAD_LENGTH/2) {
+        car.position.z += ROAD_LENGTH;
+    }
+    return turned;
+}
+
+void updateTraffic(CarPool& pool, TrafficScratch& scratch, long tick, bool followBackground,
+                   const TrafficSignals* signals) {
+    // Move every car first, so all cars react to the same snapshot. No car
+    // runs a red light, however late it started braking.
+    std::atomic<bool> turned(false);
+    parallelFor(static_cast<int>(pool.active.size()), [&pool, &turned, signals](int begin, int end) {
+        bool anyTurned = false;
+        for (int i = begin; i < end; i++) {
+            int slot = pool.active[i];
+            Car& car = pool.slots[slot];
+            float step = std::min(car.speed, distanceToRedLight(car, signals));
+            if (driveCar(car, pool.routes[slot], step)) {
+                anyTurned = true;
+            }
+        }
+        if (anyTurned) {
+            turned = true;
+        }
+    });
+
+    if (turned || scratch.revision != pool.revision || scratch.order.size() != pool.active.size()) {
+        groupByStreet(pool, scratch);
+    }
+
+    // Streets are independent of each other
+    int streets = static_cast<int>(scratch.streetBegin.size()) - 1;
+    parallelFor(streets, [&pool, &scratch, tick, followBackground, signals](int begin, int end) {
+        for (int s = begin; s < end; s++) {
+            int first = scratch.streetBegin[s];
+            followStreet(pool, &scratch.order[first], scratch.streetBegin[s + 1] - first, tick, followBackground, signals);
+        }
+    });
+}
+
+float widestStreetGap(const CarPool& pool, const TrafficScratch& scratch, int street, float& middle) {
+    int bucket = street - scratch.firstStreet;
+    int begin = 0, end = 0;
+    if (bucket >= 0 && bucket < scratch.streets && static_cast<int>(scratch.streetOffset.size()) > bucket) {
+        begin = bucket > 0 ? scratch.streetOffset[bucket - 1] : 0;
+        end = scratch.streetOffset[bucket];
+    }
+
+    // The run is sorted along the street; the street is a ring, so the gap
+    // after the last car runs round to the first
+    float first = 0.0f, previous = 0.0f, widest = 0.0f;
+    bool any = false;
+    for (int i = begin; i < end; i++) {
+        int slot = scratch.order[i];
+        const Car& car = pool.slots[slot];
+        if (pool.activeIndex[slot] < 0 || car.cross >= 0 || car.street != street) {
+            continue;
+        }
+        if (!any) {
+            first = car.position.z;
+            any = true;
+        } else if (car.position.z - previous > widest) {
+            widest = car.position.z - previous;
+            middle = previous + widest / 2;
+        }
+        previous = car.position.z;
+    }
+    if (!any) {
+        middle = 0.0f;
+        return ROAD_LENGTH;
+    }
+    float around = first + ROAD_LENGTH - previous;
+    if (around > widest) {
+        widest = around;
+        middle = previous + widest / 2;
+        if (middle >= ROAD_LENGTH/2) {
+            middle -= ROAD_LENGTH;
+        }
+    }
+    return widest;
+}
@@ -0,0 +1,75 @@
+#ifndef TRAFFIC_H
+#define TRAFFIC_H
+
+#include "road_graph.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+// Street traffic simulation. Nothing in here touches OpenGL, so the same code
+// runs in the viewer and in the headless traffic benchmark.
+
+const int CARS_PER_STREET = 4;  // Number of cars per street
+const float BRAKING_DISTANCE = 2.0f;  // Cars closer than this to the car ahead brake
+
+struct Car {
+    glm::vec3 position;
+    float speed;
+    glm::vec3 color;
+    bool movingForward;
+    bool brakingLights;  // New: for brake lights effect
+    float headlightIntensity; // New: for headlight glow
+    int street;          // Index of the street the car drives on, or last passed on a cross street
+    int cross;           // Cross street the car drives along, -1 while on a street
+};
+
+// Fixed-capacity car storage: slots are handed out from a free list, so spawning
+// and despawning cars during flight never allocates
+struct CarPool {
+    std::vector<Car> slots;
+    std::vector<int> freeSlots;    // Stack of unused slot indices
+    std::vector<int> active;       // Slots in use, in no particular order
+    std::vector<int> activeIndex;  // Position of each slot in active, -1 when free
+    std::vector<Route> routes;     // Route of each slot; empty routes keep the car on its road
+    unsigned int revision;         // Bumped whenever the set of active slots changes
+};
+
+// Active slots grouped by road and kept sorted along it between ticks, so each
+// car finds the car ahead of it without looking at the rest of the road
+struct TrafficScratch {
+    unsigned int revision;          // Pool revision the grouping was built for
+    std::vector<int> order;         // Active slots, road by road
+    std::vector<int> streetBegin;   // Start of each non-empty road in order, plus an end marker
+    std::vector<int> streetOffset;  // Counting sort buckets: streets in the active range, then cross streets,
+                                    // left holding the end of each road's run in order
+    int firstStreet, streets;       // Streets the first buckets are for
+};
+
+struct TrafficSignals;
+
+extern unsigned int trafficSeed;  // Seeds the cruising speed stream
+
+void initCarPool(CarPool& pool, int capacity);
+Car* spawnCar(CarPool& pool);
+void despawnCar(CarPool& pool, int slot);
+
+int wrapIndex(int a, int n);
+glm::vec3 streetColor(int street);
+unsigned int trafficHash(unsigned int v);
+float unitRandom(unsigned int& state);  // Advance a trafficHash() stream to its next value in [0, 1)
+float randomCruiseSpeed(int slot, long tick);
+float backgroundStreetSpeed(int street);
+float backgroundCarZ(int street, int slot, long tick);
+
+// Advance every active car by one tick, spread over the workers from parallel.h.
+// followBackground keeps cruising cars at the speed the background shader assumes.
+// Cars stop at the red lights of signals, which may be NULL for no lights.
+void updateTraffic(CarPool& pool, TrafficScratch& scratch, long tick, bool followBackground,
+                   const TrafficSignals* signals);
+
+// Width of the widest stretch of a street with no car on it, and its middle z,
+// read off the street's sorted run in the grouping updateTraffic() left
+// behind. Cars that have left the street since are skipped; cars spawned since
+// are missed, so spawn at most one car per street between updates.
+float widestStreetGap(const CarPool& pool, const TrafficScratch& scratch, int street, float& middle);
+
+#endif
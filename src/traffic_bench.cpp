@@ -0,0 +1,264 @@
+// Headless traffic benchmark: runs updateTraffic() with no window or GL context
+// over a sweep of car counts, street counts and thread counts, and prints CSV.
+// With --flyers it times updateFlyingTraffic() for that many flyers instead, and
+// with --pedestrians updateCrowd() for a crowd of that capacity.
+//
+//   traffic_bench [--max-cars N] [--max-threads N] [--car-ticks N] [--flyers N] [--pedestrians N]
+
+#include "traffic.h"
+#include "flying_traffic.h"
+#include "crowd.h"
+#include "parallel.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware cache counters for the benchmark process. Workers are started after
+// the counters are opened, so their events are inherited and folded back in
+// when they exit. Miss rates are reported as empty cells when the kernel or
+// the machine does not provide a counter.
+struct CacheCounters {
+    int fd[4];  // L1D accesses, L1D misses, LLC accesses, LLC misses
+};
+
+#ifdef __linux__
+static int openCacheCounter(unsigned long long cache, unsigned long long result) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+}
+#endif
+
+static void openCacheCounters(CacheCounters& counters) {
+#ifdef __linux__
+    counters.fd[0] = openCacheCounter(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_ACCESS);
+    counters.fd[1] = openCacheCounter(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS);
+    counters.fd[2] = openCacheCounter(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_RESULT_ACCESS);
+    counters.fd[3] = openCacheCounter(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_RESULT_MISS);
+#else
+    for (int i = 0; i < 4; i++) {
+        counters.fd[i] = -1;
+    }
+#endif
+}
+
+static void enableCacheCounters(CacheCounters& counters, bool enable) {
+#ifdef __linux__
+    for (int i = 0; i < 4; i++) {
+        if (counters.fd[i] >= 0) {
+            if (enable) {
+                ioctl(counters.fd[i], PERF_EVENT_IOC_RESET, 0);
+            }
+            ioctl(counters.fd[i], enable ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+#endif
+}
+
+// Read and close the counters; returns the miss rate as text, empty when unavailable
+static std::string missRate(CacheCounters& counters, int accessIndex) {
+    std::string rate;
+#ifdef __linux__
+    unsigned long long values[2] = {0, 0};
+    bool ok = true;
+    for (int i = 0; i < 2; i++) {
+        int fd = counters.fd[accessIndex + i];
+        ok = ok && fd >= 0 && read(fd, &values[i], sizeof(values[i])) == sizeof(values[i]);
+    }
+    if (ok && values[0] > 0) {
+        char text[32];
+        snprintf(text, sizeof(text), "%.4f", static_cast<double>(values[1]) / values[0]);
+        rate = text;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (counters.fd[accessIndex + i] >= 0) {
+            close(counters.fd[accessIndex + i]);
+        }
+    }
+#endif
+    return rate;
+}
+
+// Spread cars evenly over the streets, with a little jitter so some of them brake
+static void populate(CarPool& pool, int cars, int streets) {
+    initCarPool(pool, cars);
+    int perStreet = (cars + streets - 1) / streets;
+    for (int i = 0; i < cars; i++) {
+        Car* car = spawnCar(pool);
+        int street = i % streets;
+        int index = i / streets;
+        float jitter = static_cast<float>(trafficHash(i) & 0xffffu) / 65535.0f - 0.5f;
+        car->street = street;
+        car->position = glm::vec3(-30.0f + street * STREET_SPACING, 0.3f,
+                                  -ROAD_LENGTH/2 + (index + 0.5f + 0.5f * jitter) * ROAD_LENGTH / perStreet);
+        car->speed = randomCruiseSpeed(i, 0);
+        car->color = streetColor(street);
+        car->movingForward = (wrapIndex(street, 2) == 0);
+        car->brakingLights = false;
+        car->headlightIntensity = 1.0f;
+    }
+}
+
+// Time an update for every thread count and print a CSV row for each. setup()
+// builds fresh state before each run and returns how many agents it holds;
+// a few warm-up ticks run before the timed ones.
+static void benchTicks(const char* label, const std::vector<int>& threadCounts, const std::function<int()>& setup,
+                       const std::function<void()>& update) {
+    printf("%s,threads,ticks,ms_per_tick\n", label);
+    for (int threads : threadCounts) {
+        int agents = setup();
+        startWorkers(threads);
+
+        for (int i = 0; i < 3; i++) {
+            update();
+        }
+        long ticks = 50;
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < ticks; i++) {
+            update();
+        }
+        auto end = std::chrono::steady_clock::now();
+        stopWorkers();
+
+        double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        printf("%d,%d,%ld,%.3f\n", agents, threads, ticks, ms / ticks);
+        fflush(stdout);
+    }
+}
+
+// Time the flying traffic for every thread count, over a city of random building heights
+static void benchFlyers(int flyers, const std::vector<int>& threadCounts) {
+    FlyingTraffic traffic = FlyingTraffic();
+    benchTicks("flyers", threadCounts,
+               [&traffic, flyers]() {
+                   traffic = FlyingTraffic();
+                   initFlyingTraffic(traffic, flyers, glm::vec3(0.0f), 1u);
+                   traffic.heightField.origin = glm::vec2(-5.0f, -5.0f);
+                   traffic.heightField.cellSize = 2.0f;
+                   traffic.heightField.width = 60;
+                   traffic.heightField.depth = 60;
+                   for (int i = 0; i < 60 * 60; i++) {
+                       float height = 2.0f + static_cast<float>(trafficHash(i) & 0xffffu) / 65535.0f * 6.0f;
+                       traffic.heightField.heights.push_back(height);
+                   }
+                   return flyers;
+               },
+               [&traffic]() { updateFlyingTraffic(traffic, glm::vec3(0.0f)); });
+}
+
+static void benchPedestrians(int capacity, const std::vector<int>& threadCounts) {
+    Crowd crowd = Crowd();
+    benchTicks("pedestrians", threadCounts,
+               [&crowd, capacity]() {
+                   crowd = Crowd();
+                   initCrowd(crowd, capacity);
+                   streamCrowd(crowd, 0.0f);
+                   int pedestrians = 0;
+                   for (int c = 0; c < CROWD_CHUNKS; c++) {
+                       pedestrians += crowd.count[c];
+                   }
+                   return pedestrians;
+               },
+               [&crowd]() { updateCrowd(crowd); });
+}
+
+int main(int argc, char **argv) {
+    int maxCars = 1000000;
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    long carTicks = 20000000;  // Work per measurement, spread over as many ticks as that takes
+    int flyers = 0;
+    int pedestrians = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--max-cars" && i + 1 < argc) {
+            maxCars = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--max-threads" && i + 1 < argc) {
+            maxThreads = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--car-ticks" && i + 1 < argc) {
+            carTicks = std::max(1L, atol(argv[++i]));
+        } else if (arg == "--flyers" && i + 1 < argc) {
+            flyers = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--pedestrians" && i + 1 < argc) {
+            pedestrians = std::max(1, atoi(argv[++i]));
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    const int streetCounts[] = {15, 100, 1000, 10000};
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    if (flyers > 0) {
+        benchFlyers(flyers, threadCounts);
+        return 0;
+    }
+    if (pedestrians > 0) {
+        benchPedestrians(pedestrians, threadCounts);
+        return 0;
+    }
+
+    printf("cars,streets,threads,ticks,ns_per_car_tick,l1d_miss_rate,llc_miss_rate\n");
+    for (int cars = 100; cars <= maxCars; cars *= 10) {
+        for (int streets : streetCounts) {
+            for (int threads : threadCounts) {
+                CarPool pool = CarPool();
+                TrafficScratch scratch = TrafficScratch();
+                populate(pool, cars, streets);
+                long ticks = std::max(10L, carTicks / cars);
+
+                CacheCounters counters;
+                openCacheCounters(counters);
+                startWorkers(threads);
+
+                // Warm up: the first tick groups the cars by street and sorts them
+                long tick = 0;
+                for (int i = 0; i < 3; i++) {
+                    updateTraffic(pool, scratch, ++tick, false, NULL);
+                }
+
+                enableCacheCounters(counters, true);
+                auto start = std::chrono::steady_clock::now();
+                for (long i = 0; i < ticks; i++) {
+                    updateTraffic(pool, scratch, ++tick, false, NULL);
+                }
+                auto end = std::chrono::steady_clock::now();
+                enableCacheCounters(counters, false);
+                stopWorkers();
+
+                double ns = std::chrono::duration<double, std::nano>(end - start).count();
+                std::string l1 = missRate(counters, 0);
+                std::string llc = missRate(counters, 2);
+                printf("%d,%d,%d,%ld,%.3f,%s,%s\n", cars, streets, threads, ticks,
+                       ns / (static_cast<double>(cars) * ticks), l1.c_str(), llc.c_str());
+                fflush(stdout);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,224 @@
+#include "traffic_replay.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <iterator>
+
+static const char REPLAY_MAGIC[4] = {'C', 'D', 'T', 'R'};
+static const unsigned REPLAY_VERSION = 2;
+static const float POSITION_SCALE = 1024.0f;   // Fixed point steps per world unit
+static const float ANGLE_SCALE = 1024.0f;      // Fixed point steps per degree
+static const float DIRECTION_SCALE = 16384.0f; // Fixed point steps per unit of a direction vector
+static const long long MAX_REPLAY_SLOT = 1 << 20;
+static const size_t FLUSH_SIZE = 1 << 16;
+
+static void resetDeltaState(ReplayDeltaState& state) {
+    state.tick = 0;
+    for (int i = 0; i < 8; i++) {
+        state.camera[i] = 0;
+    }
+    state.street.clear();
+    state.z.clear();
+    state.x.clear();
+}
+
+static long long quantise(float value, float scale) {
+    return static_cast<long long>(std::floor(value * scale + 0.5f));
+}
+
+static void writeVarint(std::vector<unsigned char>& out, unsigned long long value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<unsigned char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+// Zigzag encoding keeps small negative differences small: 0, -1, 1, -2, ... -> 0, 1, 2, 3, ...
+static void writeDelta(std::vector<unsigned char>& out, long long value, long long& previous) {
+    long long delta = value - previous;
+    previous = value;
+    writeVarint(out, (static_cast<unsigned long long>(delta) << 1) ^ static_cast<unsigned long long>(delta >> 63));
+}
+
+static bool readVarint(TrafficReplay& replay, unsigned long long& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (replay.offset >= replay.data.size()) {
+            return false;
+        }
+        unsigned char byte = replay.data[replay.offset++];
+        value |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool readDelta(TrafficReplay& replay, long long& previous) {
+    unsigned long long encoded;
+    if (!readVarint(replay, encoded)) {
+        return false;
+    }
+    long long delta = static_cast<long long>(encoded >> 1) ^ -static_cast<long long>(encoded & 1);
+    previous += delta;
+    return true;
+}
+
+bool openRecording(TrafficRecorder& recorder, const std::string& path, const ReplayHeader& header) {
+    recorder.file.open(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!recorder.file) {
+        std::cerr << "Failed to open traffic recording: " << path << std::endl;
+        return false;
+    }
+    recorder.buffer.clear();
+    recorder.buffer.insert(recorder.buffer.end(), REPLAY_MAGIC, REPLAY_MAGIC + 4);
+    writeVarint(recorder.buffer, REPLAY_VERSION);
+    writeVarint(recorder.buffer, header.seed);
+    writeVarint(recorder.buffer, header.backgroundTraffic ? 1 : 0);
+    writeVarint(recorder.buffer, static_cast<unsigned long long>(std::max(0LL, quantise(header.nearRadius, POSITION_SCALE))));
+    resetDeltaState(recorder.previous);
+    recorder.frames = 0;
+    return true;
+}
+
+void recordFrame(TrafficRecorder& recorder, const ReplayFrame& frame) {
+    std::vector<unsigned char>& out = recorder.buffer;
+    ReplayDeltaState& previous = recorder.previous;
+
+    writeDelta(out, frame.tick, previous.tick);
+    writeDelta(out, quantise(frame.cameraPos.x, POSITION_SCALE), previous.camera[0]);
+    writeDelta(out, quantise(frame.cameraPos.y, POSITION_SCALE), previous.camera[1]);
+    writeDelta(out, quantise(frame.cameraPos.z, POSITION_SCALE), previous.camera[2]);
+    writeDelta(out, quantise(frame.cameraFront.x, DIRECTION_SCALE), previous.camera[3]);
+    writeDelta(out, quantise(frame.cameraFront.y, DIRECTION_SCALE), previous.camera[4]);
+    writeDelta(out, quantise(frame.cameraFront.z, DIRECTION_SCALE), previous.camera[5]);
+    writeDelta(out, quantise(frame.yaw, ANGLE_SCALE), previous.camera[6]);
+    writeDelta(out, quantise(frame.pitch, ANGLE_SCALE), previous.camera[7]);
+
+    writeVarint(out, frame.cars.size());
+    for (size_t i = 0; i < frame.cars.size(); i++) {
+        const ReplayCar& car = frame.cars[i];
+        size_t slot = static_cast<size_t>(car.slot);
+        if (slot >= previous.street.size()) {
+            previous.street.resize(slot + 1, 0);
+            previous.z.resize(slot + 1, 0);
+            previous.x.resize(slot + 1, 0);
+        }
+        // Slot and the flags share one varint
+        unsigned long long flags = (car.movingForward ? 1 : 0) | (car.brakingLights ? 2 : 0) | (car.onCross ? 4 : 0);
+        writeVarint(out, (static_cast<unsigned long long>(slot) << 3) | flags);
+        writeDelta(out, car.street, previous.street[slot]);
+        writeDelta(out, quantise(car.z, POSITION_SCALE), previous.z[slot]);
+        if (car.onCross) {
+            writeDelta(out, quantise(car.x, POSITION_SCALE), previous.x[slot]);
+        }
+    }
+    recorder.frames++;
+
+    if (out.size() >= FLUSH_SIZE) {
+        recorder.file.write(reinterpret_cast<const char*>(&out[0]), out.size());
+        out.clear();
+    }
+}
+
+void closeRecording(TrafficRecorder& recorder) {
+    if (!recorder.buffer.empty()) {
+        recorder.file.write(reinterpret_cast<const char*>(&recorder.buffer[0]), recorder.buffer.size());
+        recorder.buffer.clear();
+    }
+    std::streamoff bytes = recorder.file.tellp();
+    recorder.file.close();
+    std::cout << "Recorded " << recorder.frames << " ticks of traffic (" << bytes << " bytes)" << std::endl;
+}
+
+bool openReplay(TrafficReplay& replay, const std::string& path, ReplayHeader& header) {
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to open traffic recording: " << path << std::endl;
+        return false;
+    }
+    replay.data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    replay.offset = 4;
+    replay.frames = 0;
+    resetDeltaState(replay.previous);
+
+    unsigned long long version, seed, background, nearRadius;
+    if (replay.data.size() < 4 || !std::equal(REPLAY_MAGIC, REPLAY_MAGIC + 4, replay.data.begin())) {
+        std::cerr << "Not a traffic recording: " << path << std::endl;
+        return false;
+    }
+    if (!readVarint(replay, version) || version != REPLAY_VERSION) {
+        std::cerr << "Unsupported traffic recording version in " << path << std::endl;
+        return false;
+    }
+    if (!readVarint(replay, seed) || !readVarint(replay, background) || !readVarint(replay, nearRadius)) {
+        std::cerr << "Truncated traffic recording: " << path << std::endl;
+        return false;
+    }
+    header.seed = static_cast<unsigned>(seed);
+    header.backgroundTraffic = background != 0;
+    header.nearRadius = nearRadius / POSITION_SCALE;
+    return true;
+}
+
+bool readReplayFrame(TrafficReplay& replay, ReplayFrame& frame) {
+    if (replay.offset >= replay.data.size()) {
+        return false;
+    }
+
+    ReplayDeltaState& previous = replay.previous;
+    for (int i = 0; i < 8; i++) {
+        if ((i == 0 && !readDelta(replay, previous.tick)) || !readDelta(replay, previous.camera[i])) {
+            std::cerr << "Truncated traffic recording after " << replay.frames << " ticks" << std::endl;
+            return false;
+        }
+    }
+    frame.tick = static_cast<long>(previous.tick);
+    frame.cameraPos = glm::vec3(previous.camera[0] / POSITION_SCALE,
+                                previous.camera[1] / POSITION_SCALE,
+                                previous.camera[2] / POSITION_SCALE);
+    frame.cameraFront = glm::vec3(previous.camera[3] / DIRECTION_SCALE,
+                                  previous.camera[4] / DIRECTION_SCALE,
+                                  previous.camera[5] / DIRECTION_SCALE);
+    frame.yaw = previous.camera[6] / ANGLE_SCALE;
+    frame.pitch = previous.camera[7] / ANGLE_SCALE;
+
+    unsigned long long count;
+    if (!readVarint(replay, count) || count > replay.data.size() - replay.offset) {
+        std::cerr << "Corrupt traffic recording after " << replay.frames << " ticks" << std::endl;
+        return false;
+    }
+    frame.cars.resize(static_cast<size_t>(count));
+    for (size_t i = 0; i < frame.cars.size(); i++) {
+        unsigned long long key;
+        if (!readVarint(replay, key) || static_cast<long long>(key >> 3) >= MAX_REPLAY_SLOT) {
+            std::cerr << "Corrupt traffic recording after " << replay.frames << " ticks" << std::endl;
+            return false;
+        }
+        size_t slot = static_cast<size_t>(key >> 3);
+        bool onCross = (key & 4) != 0;
+        if (slot >= previous.street.size()) {
+            previous.street.resize(slot + 1, 0);
+            previous.z.resize(slot + 1, 0);
+            previous.x.resize(slot + 1, 0);
+        }
+        if (!readDelta(replay, previous.street[slot]) || !readDelta(replay, previous.z[slot]) ||
+            (onCross && !readDelta(replay, previous.x[slot]))) {
+            std::cerr << "Truncated traffic recording after " << replay.frames << " ticks" << std::endl;
+            return false;
+        }
+
+        ReplayCar& car = frame.cars[i];
+        car.slot = static_cast<int>(slot);
+        car.street = static_cast<int>(previous.street[slot]);
+        car.z = previous.z[slot] / POSITION_SCALE;
+        car.x = previous.x[slot] / POSITION_SCALE;
+        car.onCross = onCross;
+        car.movingForward = (key & 1) != 0;
+        car.brakingLights = (key & 2) != 0;
+    }
+    replay.frames++;
+    return true;
+}
@@ -0,0 +1,72 @@
+#ifndef TRAFFIC_REPLAY_H
+#define TRAFFIC_REPLAY_H
+
+#include <glm/glm.hpp>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Traffic recordings store, for every tick, the camera pose and the state of
+// every simulated car. Values are quantised to fixed point and written as
+// zigzag varints holding the difference to the previous tick, so a car that
+// keeps driving costs about four bytes per tick.
+
+// Settings the recording was made with; replay restores them so the
+// world around the recorded cars is rebuilt identically
+struct ReplayHeader {
+    unsigned seed;            // Seed passed to srand()
+    bool backgroundTraffic;   // Distant streets drawn by the background shader
+    float nearRadius;         // Radius of the individually simulated streets
+};
+
+struct ReplayCar {
+    int slot;                 // Car pool slot, stable for as long as the car lives
+    int street;
+    float z;
+    float x;                  // Only recorded for cars on a cross street
+    bool onCross;
+    bool movingForward;       // Towards +x on a cross street
+    bool brakingLights;
+};
+
+struct ReplayFrame {
+    long tick;
+    glm::vec3 cameraPos;
+    glm::vec3 cameraFront;
+    float yaw;                // Kept alongside cameraFront for the X-wing's orientation
+    float pitch;
+    std::vector<ReplayCar> cars;
+};
+
+// Last values written or read, which the next tick is encoded against
+struct ReplayDeltaState {
+    long long tick;
+    long long camera[8];
+    std::vector<long long> street;  // Per slot
+    std::vector<long long> z;       // Per slot
+    std::vector<long long> x;       // Per slot
+};
+
+struct TrafficRecorder {
+    std::ofstream file;
+    std::vector<unsigned char> buffer;  // Encoded ticks not yet written to the file
+    ReplayDeltaState previous;
+    long frames;
+};
+
+struct TrafficReplay {
+    std::vector<unsigned char> data;    // Whole file, read up front so replay does no I/O
+    size_t offset;
+    ReplayDeltaState previous;
+    long frames;
+};
+
+bool openRecording(TrafficRecorder& recorder, const std::string& path, const ReplayHeader& header);
+void recordFrame(TrafficRecorder& recorder, const ReplayFrame& frame);
+void closeRecording(TrafficRecorder& recorder);
+
+bool openReplay(TrafficReplay& replay, const std::string& path, ReplayHeader& header);
+// Decode the next tick into frame, reusing its storage; false at the end of the recording
+bool readReplayFrame(TrafficReplay& replay, ReplayFrame& frame);
+
+#endif
@@ -0,0 +1,105 @@
+#include "traffic_signals.h"
+#include "traffic.h"
+
+int signalIndex(int street, int cross) {
+    return (street & (SIGNAL_STREET_SLOTS - 1)) * NUM_CROSS_STREETS + cross;
+}
+
+// Avenues carry more traffic, so they get a longer green
+static long phaseTicks(int street, int phase) {
+    switch (phase) {
+    case SIGNAL_STREET_GREEN:
+        return wrapIndex(street, AVENUE_PERIOD) == 0 ? SIGNAL_STREET_GREEN_TICKS * 3 / 2 : SIGNAL_STREET_GREEN_TICKS;
+    case SIGNAL_CROSS_GREEN:
+        return SIGNAL_CROSS_GREEN_TICKS;
+    default:
+        return SIGNAL_CLEARANCE_TICKS;
+    }
+}
+
+static int nextPhase(int phase) {
+    return phase == SIGNAL_CROSS_CLEARING ? SIGNAL_STREET_GREEN : phase + 1;
+}
+
+void initTrafficSignals(TrafficSignals& signals, long now) {
+    for (int i = 0; i < MAX_SIGNALS; i++) {
+        signals.phase[i] = SIGNAL_OFF;
+        signals.timer[i] = -1;
+    }
+    for (int i = 0; i < SIGNAL_STREET_SLOTS; i++) {
+        signals.occupied[i] = false;
+    }
+    initTimerWheel(signals.wheel, MAX_SIGNALS, now);
+    signals.changed.clear();
+    signals.expired.clear();
+}
+
+void addStreetSignals(TrafficSignals& signals, int street, long now) {
+    int slot = street & (SIGNAL_STREET_SLOTS - 1);
+    if (signals.occupied[slot]) {
+        removeStreetSignals(signals, signals.street[slot]);
+    }
+    signals.occupied[slot] = true;
+    signals.street[slot] = street;
+
+    long cycle = 0;
+    for (int phase = SIGNAL_STREET_GREEN; phase <= SIGNAL_CROSS_CLEARING; phase++) {
+        cycle += phaseTicks(street, phase);
+    }
+    for (int c = 0; c < NUM_CROSS_STREETS; c++) {
+        // Every light runs the same cycle from its own hashed offset, so a
+        // street that streams out and back in finds its lights as it left them
+        unsigned int h = trafficHash(trafficHash(static_cast<unsigned int>(street * NUM_CROSS_STREETS + c)) + trafficSeed);
+        long t = (now + static_cast<long>(h % static_cast<unsigned int>(cycle))) % cycle;
+        int phase = SIGNAL_STREET_GREEN;
+        while (t >= phaseTicks(street, phase)) {
+            t -= phaseTicks(street, phase);
+            phase++;
+        }
+
+        int index = slot * NUM_CROSS_STREETS + c;
+        signals.phase[index] = static_cast<unsigned char>(phase);
+        signals.timer[index] = scheduleTimer(signals.wheel, now + phaseTicks(street, phase) - t, index);
+        signals.changed.push_back(index);
+    }
+}
+
+void removeStreetSignals(TrafficSignals& signals, int street) {
+    int slot = street & (SIGNAL_STREET_SLOTS - 1);
+    if (!signals.occupied[slot] || signals.street[slot] != street) {
+        return;
+    }
+    signals.occupied[slot] = false;
+    for (int c = 0; c < NUM_CROSS_STREETS; c++) {
+        int index = slot * NUM_CROSS_STREETS + c;
+        cancelTimer(signals.wheel, signals.timer[index]);
+        signals.timer[index] = -1;
+        signals.phase[index] = SIGNAL_OFF;
+        signals.changed.push_back(index);
+    }
+}
+
+void updateTrafficSignals(TrafficSignals& signals, long now) {
+    signals.expired.clear();
+    advanceTimerWheel(signals.wheel, now, signals.expired);
+    for (int index : signals.expired) {
+        int street = signals.street[index / NUM_CROSS_STREETS];
+        int phase = nextPhase(signals.phase[index]);
+        signals.phase[index] = static_cast<unsigned char>(phase);
+        signals.timer[index] = scheduleTimer(signals.wheel, signals.wheel.now + phaseTicks(street, phase), index);
+        signals.changed.push_back(index);
+    }
+}
+
+void clearSignalChanges(TrafficSignals& signals) {
+    signals.changed.clear();
+}
+
+bool signalRed(const TrafficSignals& signals, int street, int cross, bool alongStreet) {
+    int slot = street & (SIGNAL_STREET_SLOTS - 1);
+    if (!signals.occupied[slot] || signals.street[slot] != street) {
+        return false;  // No light there
+    }
+    int phase = signals.phase[slot * NUM_CROSS_STREETS + cross];
+    return phase != (alongStreet ? SIGNAL_STREET_GREEN : SIGNAL_CROSS_GREEN);
+}
@@ -0,0 +1,51 @@
+#ifndef TRAFFIC_SIGNALS_H
+#define TRAFFIC_SIGNALS_H
+
+#include "road_graph.h"
+#include "timer_wheel.h"
+#include <vector>
+
+// Traffic lights at the intersections of the streets the cars are simulated
+// on. Each light cycles street green, all red, cross green, all red; every
+// phase change is a timer on the wheel, so a tick only touches the lights
+// that actually change.
+
+const int SIGNAL_STREET_SLOTS = 64;  // Power of two, more than the resident streets
+const int MAX_SIGNALS = SIGNAL_STREET_SLOTS * NUM_CROSS_STREETS;
+const float SIGNAL_STOP_DISTANCE = 1.2f;  // Cars stop this far before the intersection
+
+const long SIGNAL_STREET_GREEN_TICKS = 300;
+const long SIGNAL_CROSS_GREEN_TICKS = 240;
+const long SIGNAL_CLEARANCE_TICKS = 60;  // All red, so the intersection empties
+
+enum SignalPhase {
+    SIGNAL_OFF,
+    SIGNAL_STREET_GREEN,
+    SIGNAL_STREET_CLEARING,
+    SIGNAL_CROSS_GREEN,
+    SIGNAL_CROSS_CLEARING
+};
+
+struct TrafficSignals {
+    // Signal index = (street & (SIGNAL_STREET_SLOTS - 1)) * NUM_CROSS_STREETS + cross
+    unsigned char phase[MAX_SIGNALS];
+    int timer[MAX_SIGNALS];  // Pending phase change, -1 when off
+    int street[SIGNAL_STREET_SLOTS];  // Street holding each slot
+    bool occupied[SIGNAL_STREET_SLOTS];
+    TimerWheel wheel;
+    std::vector<int> changed;  // Signals whose phase changed since the last clearSignalChanges()
+    std::vector<int> expired;  // Scratch
+};
+
+void initTrafficSignals(TrafficSignals& signals, long now);
+// Light every intersection of a street, picking up its cycle where it would be at tick now
+void addStreetSignals(TrafficSignals& signals, int street, long now);
+void removeStreetSignals(TrafficSignals& signals, int street);
+void updateTrafficSignals(TrafficSignals& signals, long now);
+void clearSignalChanges(TrafficSignals& signals);
+
+int signalIndex(int street, int cross);
+// True when traffic along the street (or along the cross street) must stop there
+bool signalRed(const TrafficSignals& signals, int street, int cross, bool alongStreet);
+
+#endif